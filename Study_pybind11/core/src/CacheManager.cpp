@@ -3,9 +3,53 @@
 #include "snappy/snappy.h"
 #include "common.h"
 #include "msvc_compat.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+//hash.h, its uint64 conflicts with h7::uint64.
+extern "C" uint64_t fasthash64(const void *buf, uint32_t len, uint64_t seed);
 
 using namespace h7;
 
+#define __CACHE_HASH_SEED 11
+#define __CACHE_HASH_CHUNK (1 << 20)
+
+//fasthash64 of the data by fixed chunks, every chunk is seeded by the hash of the
+//previous one. so data of any size can be hashed piece by piece.
+struct ChunkHasher{
+    uint64 hash {__CACHE_HASH_SEED};
+    std::string pending;
+
+    void update(const char* data, uint64 len){
+        if(!pending.empty()){
+            auto _size = HMIN(len, (uint64)__CACHE_HASH_CHUNK - pending.length());
+            pending.append(data, _size);
+            data += _size;
+            len -= _size;
+            if(pending.length() < __CACHE_HASH_CHUNK){
+                return;
+            }
+            hash = fasthash64(pending.data(), pending.length(), hash);
+            pending.clear();
+        }
+        while (len >= __CACHE_HASH_CHUNK) {
+            hash = fasthash64(data, __CACHE_HASH_CHUNK, hash);
+            data += __CACHE_HASH_CHUNK;
+            len -= __CACHE_HASH_CHUNK;
+        }
+        if(len > 0){
+            pending.append(data, len);
+        }
+    }
+    uint64 digest(){
+        if(!pending.empty()){
+            hash = fasthash64(pending.data(), pending.length(), hash);
+            pending.clear();
+        }
+        return hash;
+    }
+};
+
 static inline void readBigFile(CString rfile, std::vector<char>& _buffer){
     FILE* stream_in = fopen64(rfile.data(), "rb");
     if(stream_in == NULL){
@@ -20,10 +64,111 @@ static inline void readBigFile(CString rfile, std::vector<char>& _buffer){
     fclose(stream_in);
 }
 
+static inline uint64 getFileSize(CString rfile){
+    FILE* stream_in = fopen64(rfile.data(), "rb");
+    if(stream_in == NULL){
+        return 0;
+    }
+    fseeko64(stream_in, 0, SEEK_END);
+    uint64 _size = ftello64(stream_in);
+    fclose(stream_in);
+    return _size;
+}
+
+//run func(i) for every fragment. on the pool if need.
+static inline bool runFragTasks(int tc, int count, std::function<bool(int)> func){
+    if(count <= 0){
+        return true;
+    }
+    if(tc <= 1 || count == 1){
+        for(int i = 0 ; i < count ; ++i){
+            if(!func(i)){
+                return false;
+            }
+        }
+        return true;
+    }
+    return ThreadPool::batchRawRun(tc, 0, count, func) != 0;
+}
+
 void CacheManager::addFileItem(const std::string& name, const std::string& filePath){
-    std::vector<char> buf;
-    readBigFile(filePath, buf);
-    addItem(name, buf.data(), buf.size());
+    WriteGuard g(m_rwLock);
+    Item item;
+    setItemName(item, name);
+    item.raw_size = 0;
+    ChunkHasher hasher;
+    //read by chunks, so only one chunk is held besides the fragments.
+    FILE* stream_in = fopen64(filePath.data(), "rb");
+    if(stream_in != NULL){
+        std::vector<char> buf(__CACHE_READ_CHUNK_SIZE);
+        size_t n;
+        while ((n = fread(buf.data(), 1, buf.size(), stream_in)) > 0) {
+            appendItemData(item, buf.data(), n);
+            if(m_itemHash){
+                hasher.update(buf.data(), n);
+            }
+        }
+        fclose(stream_in);
+    }
+    if(m_itemHash){
+        item.flags |= kFlag_HASHED;
+        item.hash = hasher.digest();
+    }
+    addItem0(std::move(item));
+}
+void CacheManager::addFileItems(const std::vector<std::string>& names,
+                                const std::vector<std::string>& filePaths){
+    MED_ASSERT(names.size() == filePaths.size());
+    const int count = names.size();
+    std::vector<uint64> sizes(count);
+    for(int i = 0 ; i < count ; ++i){
+        sizes[i] = getFileSize(filePaths[i]);
+    }
+    const bool itemHash = m_itemHash;
+    std::vector<std::vector<char>> datas;
+    std::vector<uint64> hashes;
+    int start = 0;
+    while (start < count) {
+        if(sizes[start] > __CACHE_INGEST_BUDGET){
+            addFileItem(names[start], filePaths[start]);
+            start ++;
+            continue;
+        }
+        int end = start;
+        uint64 bytes = 0;
+        while (end < count && sizes[end] <= __CACHE_INGEST_BUDGET
+               && bytes + sizes[end] <= __CACHE_INGEST_BUDGET) {
+            bytes += sizes[end ++];
+        }
+        //read and hash the batch on the pool.
+        datas.resize(end - start);
+        hashes.resize(end - start);
+        runFragTasks(m_threadCount, end - start,
+                     [start, itemHash, &filePaths, &datas, &hashes](int k){
+            readBigFile(filePaths[start + k], datas[k]);
+            if(itemHash){
+                ChunkHasher hasher;
+                hasher.update(datas[k].data(), datas[k].size());
+                hashes[k] = hasher.digest();
+            }
+            return true;
+        });
+        //then add it in order.
+        WriteGuard g(m_rwLock);
+        for(int k = 0 ; k < end - start ; ++k){
+            Item item;
+            setItemName(item, names[start + k]);
+            item.raw_size = 0;
+            appendItemData(item, datas[k].data(), datas[k].size());
+            if(itemHash){
+                item.flags |= kFlag_HASHED;
+                item.hash = hashes[k];
+            }
+            addItem0(std::move(item));
+            std::vector<char>().swap(datas[k]);
+        }
+        start = end;
+    }
 }
 void CacheManager::addFileItemCompressed(const std::string& name, const std::string& filePath){
     std::vector<char> buf;
@@ -32,60 +177,62 @@ void CacheManager::addFileItemCompressed(const std::string& name, const std::str
 }
 void CacheManager::addItem(const std::string& name, const char* data, uint64 len,
                            uint32 flags){
+    WriteGuard g(m_rwLock);
     Item item;
-    memcpy(item.name, name.data(), name.length() + 1);
-    item.raw_size = len;
-    item.flags = flags;
-    //
-    auto usedSize = getLastFragUsedSize();
-    if(usedSize == 0){
-        auto frag_id = m_data.size();
-        auto left = len;
-        uint64 ptr_offset = 0;
-        while (left > 0) {
-            auto _size = HMIN(left, m_maxFragSize);
-            auto& _block = newBlock(_size);
-            memcpy(_block.data(), data + ptr_offset, _size);
-            ptr_offset += _size;
-            left -= _size;
-            //frag id
-            item.frag_ids.push_back(frag_id);
-            frag_id ++;
+    setItemName(item, name);
+    item.raw_size = 0;
+    item.flags = flags & ~kFlag_HASHED;
+    if(m_itemHash){
+        ChunkHasher hasher;
+        hasher.update(data, len);
+        item.flags |= kFlag_HASHED;
+        item.hash = hasher.digest();
+    }
+    appendItemData(item, data, len);
+    addItem0(std::move(item));
+}
+void CacheManager::appendItemData(Item& item, const char* data, uint64 len){
+    uint64 ptr_offset = 0;
+    while (len > 0) {
+        auto usedSize = getLastFragUsedSize();
+        if(m_data.empty() || usedSize >= m_maxFragSize){
+            newBlock(0);
+            usedSize = 0;
+            if(m_streaming){
+                //a streaming fragment never grows over the max size.
+                m_data.back().data->reserve(m_maxFragSize);
+            }
         }
-        item.frag_offset = 0;
-    }else{
-        auto last_free_size = m_maxFragSize - usedSize;
-        //data is small.
-        if(len <= last_free_size){
-            auto& block = getLastBlock(usedSize + len);
-            memcpy(block.data() + usedSize, data, len);
-            //
-            item.frag_ids.push_back(getLastBlockId());
+        auto _size = HMIN(len, m_maxFragSize - usedSize);
+        auto& block = getLastBlock(usedSize + _size);
+        memcpy(block.data() + usedSize, data + ptr_offset, _size);
+        //the first frag holds the item head.
+        if(item.frag_ids.empty()){
             item.frag_offset = usedSize;
-        }else{
-            //add some data to old frag. and left data to new frag
-            auto& block = getLastBlock(m_maxFragSize);
-            memcpy(block.data() + usedSize, data, last_free_size);
-            //first frag id
-            auto frag_id = getLastBlockId();
-            item.frag_ids.push_back(frag_id);
-            item.frag_offset = usedSize;
-            frag_id++;
-            //
-            auto left = len - last_free_size;
-            uint64 ptr_offset = last_free_size;
-            while (left > 0) {
-                auto _size = HMIN(left, m_maxFragSize);
-                auto& _block = newBlock(_size);
-                memcpy(_block.data(), data + ptr_offset, _size);
-                ptr_offset += _size;
-                left -= _size;
-                //frag id
-                item.frag_ids.push_back(frag_id);
-                frag_id ++;
-            }
         }
+        if(item.frag_ids.empty() || item.frag_ids.back() != getLastBlockId()){
+            item.frag_ids.push_back(getLastBlockId());
+        }
+        item.raw_size += _size;
+        ptr_offset += _size;
+        len -= _size;
+        if(m_streaming && usedSize + _size == m_maxFragSize){
+            flushFragment(getLastBlockId());
+        }
+    }
+}
+void CacheManager::addItem0(Item&& item){
+    if(item.frag_ids.empty()){
+        item.frag_offset = 0;
+    }
+    //the first item of the name wins.
+    if(!m_index.emplace(std::string_view(item.name, item.name_len), m_items.size()).second){
+        m_shadowedCount ++;
+    }
+    if(!m_liveIds.empty()){
+        m_liveIds.push_back(m_items.size());
     }
+    m_sortedIds.clear();
     m_items.push_back(std::move(item));
 }
 void CacheManager::addItemCompressed(const std::string& name, const char* data,
@@ -96,6 +243,7 @@ void CacheManager::addItemCompressed(const std::string& name, const char* data,
 }
 
 void CacheManager::getItemDataUnCompressed(const std::string& name, std::string& out){
+    ReadGuard g(m_rwLock);
     auto _idx = getItemByName(name);
     if(_idx < 0){
         return;
@@ -109,9 +257,11 @@ void CacheManager::getItemDataUnCompressed(const std::string& name, std::string&
     }
 }
 
-void CacheManager::getItemAt(unsigned int _idx, std::string& o_name, std::string& o_data){
-    MED_ASSERT(_idx < m_items.size());
-    o_name = m_items[_idx].name;
+void CacheManager::getItemAt(unsigned int index, std::string& o_name, std::string& o_data){
+    ReadGuard g(m_rwLock);
+    MED_ASSERT(index < m_items.size() - m_removedCount);
+    auto _idx = getLiveItemIndex(index);
+    o_name.assign(m_items[_idx].name, m_items[_idx].name_len);
     if( (m_items[_idx].flags & kFlag_COMPRESSED) != 0){
         std::string _out;
         getItemData0(_idx, _out);
@@ -122,6 +272,7 @@ void CacheManager::getItemAt(unsigned int _idx, std::string& o_name, std::string
 }
 
 void CacheManager::getItemData(CString name, std::string& out){
+    ReadGuard g(m_rwLock);
     auto _idx = getItemByName(name);
     if(_idx < 0){
         return;
@@ -130,112 +281,346 @@ void CacheManager::getItemData(CString name, std::string& out){
 }
 
 void CacheManager::removeItem(CString name){
+    WriteGuard g(m_rwLock);
     auto _idx = getItemByName(name);
     if(_idx < 0){
         return;
     }
-    Item* _item = &m_items[_idx];
-    if(_item->frag_offset == 0){
-        auto firstId = _item->frag_ids[0];
-        int rm_count = _item->raw_size / m_maxFragSize;
-        //check last block need remove or not.
-        auto lastId = _item->frag_ids[_item->frag_ids.size()-1];
-        if(lastId != firstId && m_data[lastId].size() == (_item->raw_size % m_maxFragSize)){
-            rm_count ++;
-        }
-        //
-        for(int i = rm_count -1 ; i >= 0 ; --i){
-            m_data.erase(m_data.begin() + firstId + i);
-        }
-        m_items.erase(m_items.begin() + _idx);
-        //sync frag ids after items id
-        for(uint32 i = 0 ; i < m_items.size() ; i ++){
-            for(auto& id : m_items[i].frag_ids){
-                 if(id >= firstId){
-                     id -= rm_count;
-                 }
+    Item& item = m_items[_idx];
+    item.removed = true;
+    //the next alive item of the same name takes the name, like a scan from the start.
+    auto it = m_index.find(std::string_view(item.name, item.name_len));
+    bool taken = false;
+    if(m_shadowedCount > 0){
+        for(uint32 i = _idx + 1 ; i < (uint32)m_items.size() ; i ++){
+            auto& oth = m_items[i];
+            if(!oth.removed && oth.name_len == item.name_len
+                    && memcmp(oth.name, item.name, item.name_len) == 0){
+                it->second = i;
+                m_shadowedCount --;
+                taken = true;
+                break;
             }
         }
+    }
+    if(!taken){
+        m_index.erase(it);
+    }
+    //track the free data of every fragment it touches.
+    uint64 left_size = item.raw_size;
+    uint64 start = item.frag_offset;
+    for(auto id: item.frag_ids){
+        auto _size = HMIN(left_size, m_data[id].size - start);
+        m_data[id].free_size += _size;
+        m_data[id].removed_size += _size;
+        left_size -= _size;
+        start = 0;
+    }
+    m_freeSize += item.raw_size;
+    m_removedCount ++;
+    m_liveIds.clear();
+    m_sortedIds.clear();
+}
+
+void CacheManager::compact(){
+    WriteGuard g(m_rwLock);
+    compact0(true);
+}
+void CacheManager::compact0(bool all){
+    if(m_removedCount == 0 && (!all || m_freeSize == 0)){
         return;
     }
-    if(_item->frag_ids.size() > 1){
-        //first block don't need remove.
-        uint32 firstId = _item->frag_ids[1];
-        uint32 lastId = _item->frag_ids[_item->frag_ids.size() - 1];
-        auto left_size = _item->raw_size - _item->frag_offset;
-        int rm_count = left_size / m_maxFragSize;
-        //check last block.
-        if(lastId != firstId && m_data[lastId].size() == (left_size % m_maxFragSize)){
-            rm_count ++;
-        }
-        //remove blocks
-        for(int i = rm_count -1 ; i >= 0 ; --i){
-            m_data.erase(m_data.begin() + firstId + i);
-        }
-        if(_idx == (int)m_items.size() - 1){
-            //already the last item. no id need dec.
-            m_items.erase(m_items.begin() + _idx);
-        }else{
-            m_items.erase(m_items.begin() + _idx);
-            //sync frag ids after items id
-            for(uint32 i = 0 ; i < m_items.size() ; i ++){
-                for(auto& id : m_items[i].frag_ids){
-                     if(id >= firstId){
-                         id -= rm_count;
-                     }
+    const uint32 frag_count = m_data.size();
+    std::vector<char> dirty(frag_count, 0);
+    for(uint32 id = 0 ; id < frag_count ; id ++){
+        auto& frag = m_data[id];
+        dirty[id] = (all ? frag.free_size : frag.removed_size) > 0;
+    }
+    //the alive parts of the dirty fragments. an item goes on at offset 0 of its next
+    //fragment, so keeping the parts in order keeps the item offsets right.
+    struct Part{
+        uint64 start;
+        uint64 len;
+        uint32 item;
+        bool head; //the first part of the item.
+    };
+    std::unordered_map<uint32, std::vector<Part>> parts;
+    for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+        auto& item = m_items[i];
+        if(item.removed){
+            continue;
+        }
+        uint64 left_size = item.raw_size;
+        uint64 start = item.frag_offset;
+        for(size_t k = 0 ; k < item.frag_ids.size() ; k ++){
+            auto id = item.frag_ids[k];
+            auto _size = HMIN(left_size, m_data[id].size - start);
+            if(dirty[id]){
+                parts[id].push_back({start, _size, i, k == 0});
+            }
+            left_size -= _size;
+            start = 0;
+        }
+    }
+    //rewrite the dirty fragments one by one, the others are kept(lazy ones are not
+    //loaded). an empty one is dropped, the later ids move down.
+    std::vector<Fragment> newData;
+    std::vector<uint32> newIds(frag_count, 0);
+    for(uint32 id = 0 ; id < frag_count ; id ++){
+        if(!dirty[id]){
+            newIds[id] = newData.size();
+            newData.push_back(std::move(m_data[id]));
+            continue;
+        }
+        auto& ps = parts[id];
+        std::sort(ps.begin(), ps.end(), [](const Part& a, const Part& b){
+            return a.start < b.start;
+        });
+        uint64 size = 0;
+        for(auto& p : ps){
+            size += p.len;
+        }
+        newIds[id] = newData.size();
+        if(size > 0){
+            const char* src = getFragData(id);
+            Fragment frag;
+            frag.data = std::make_shared<std::vector<char>>(size);
+            frag.size = size;
+            uint64 pos = 0;
+            for(auto& p : ps){
+                memcpy(frag.data->data() + pos, src + p.start, p.len);
+                if(p.head){
+                    m_items[p.item].frag_offset = pos;
                 }
+                pos += p.len;
             }
+            newData.push_back(std::move(frag));
         }
+        m_data[id] = Fragment();
+    }
+    //the names are copied too, so the removed ones are freed.
+    std::vector<Item> items;
+    items.reserve(m_items.size() - m_removedCount);
+    NameArena names;
+    for(auto& item : m_items){
+        if(item.removed){
+            continue;
+        }
+        for(auto& nid : item.frag_ids){
+            nid = newIds[nid];
+        }
+        item.name = names.add(item.name, item.name_len);
+        items.push_back(std::move(item));
+    }
+    m_data = std::move(newData);
+    m_items = std::move(items);
+    m_names = std::move(names);
+    rebuildIndex();
+    //fragment ids are changed.
+    m_blockCache.clear();
+    m_liveIds.clear();
+    m_sortedIds.clear();
+    m_removedCount = 0;
+    m_freeSize = 0;
+    for(auto& frag : m_data){
+        m_freeSize += frag.free_size;
+    }
+}
+
+uint32 CacheManager::merge(CacheManager& oth){
+    if(&oth == this){
+        return 0;
+    }
+    WriteGuard g(m_rwLock, std::defer_lock);
+    ReadGuard g_oth(oth.m_rwLock, std::defer_lock);
+    //locked in address order, so 'a.merge(b)' and 'b.merge(a)' don't deadlock.
+    if(std::less<std::shared_mutex*>()(&m_rwLock, &oth.m_rwLock)){
+        g.lock();
+        g_oth.lock();
     }else{
-        //only on one block and have other item. no need remove block
-        m_items.erase(m_items.begin() + _idx);
+        g_oth.lock();
+        g.lock();
+    }
+    MED_ASSERT(!m_streaming);
+    //pick the items by the name index, then append the fragments they touch.
+    std::vector<uint32> picked;
+    picked.reserve(oth.m_items.size());
+    for(uint32 i = 0 ; i < (uint32)oth.m_items.size() ; i ++){
+        auto& item = oth.m_items[i];
+        if(!item.removed && m_index.find(std::string_view(item.name, item.name_len))
+                == m_index.end()){
+            picked.push_back(i);
+        }
+    }
+    if(picked.empty()){
+        return 0;
+    }
+    const uint32 base = m_data.size();
+    m_data.reserve(base + oth.m_data.size());
+    for(auto& frag : oth.m_data){
+        m_data.push_back(frag);
+        //all data is free until an item takes it.
+        m_data.back().free_size = frag.size;
+        m_data.back().removed_size = 0;
+    }
+    for(auto i : picked){
+        auto& src = oth.m_items[i];
+        Item item;
+        setItemName(item, std::string(src.name, src.name_len));
+        item.flags = src.flags;
+        item.frag_offset = src.frag_offset;
+        item.raw_size = src.raw_size;
+        item.hash = src.hash;
+        item.frag_ids.reserve(src.frag_ids.size());
+        uint64 left_size = src.raw_size;
+        uint64 start = src.frag_offset;
+        for(auto id : src.frag_ids){
+            auto& frag = m_data[base + id];
+            auto _size = HMIN(left_size, frag.size - start);
+            frag.free_size -= _size;
+            left_size -= _size;
+            start = 0;
+            item.frag_ids.push_back(base + id);
+        }
+        addItem0(std::move(item));
     }
+    for(uint32 id = base ; id < (uint32)m_data.size() ; id ++){
+        m_freeSize += m_data[id].free_size;
+    }
+    return picked.size();
 }
 
 uint32 CacheManager::getItemCount(){
-    return m_items.size();
+    ReadGuard g(m_rwLock);
+    return m_items.size() - m_removedCount;
 }
 std::vector<String> CacheManager::getItemNames(){
+    ReadGuard g(m_rwLock);
     std::vector<String> ret;
-    ret.reserve(m_items.size());
+    ret.reserve(m_items.size() - m_removedCount);
     for(auto& item : m_items){
-        ret.push_back(item.name);
+        if(!item.removed){
+            ret.emplace_back(item.name, item.name_len);
+        }
     }
     return ret;
 }
 
-uint64 CacheManager::computeRecordSize(){
+std::vector<String> CacheManager::listPrefix(CString prefix){
+    ReadGuard g(m_rwLock);
+    return listSorted0(prefix, std::string(), true);
+}
+std::vector<String> CacheManager::listRange(CString first, CString last){
+    ReadGuard g(m_rwLock);
+    return listSorted0(first, last, false);
+}
+std::vector<String> CacheManager::listSorted0(CString first, CString last, bool isPrefix){
+    std::vector<String> ret;
+    auto& ids = getSortedIds();
+    auto it = std::lower_bound(ids.begin(), ids.end(), std::string_view(first),
+                               [this](uint32 id, std::string_view key){
+        return std::string_view(m_items[id].name, m_items[id].name_len) < key;
+    });
+    //a prefix query stops at the first name without it.
+    for(; it != ids.end() ; ++it){
+        std::string_view name(m_items[*it].name, m_items[*it].name_len);
+        if(isPrefix){
+            if(name.compare(0, first.length(), first) != 0){
+                break;
+            }
+        }else if(!last.empty() && name >= last){
+            break;
+        }
+        ret.emplace_back(name);
+    }
+    return ret;
+}
+
+uint64 CacheManager::computeRecordSize(const FragBlockTables& tables, uint64 namesSize){
     uint64 _size = 0;
+    _size += sizeof(uint32) * 2; //magic + version
     _size += sizeof(uint32) * 2; //block_count + item_count
     _size += sizeof(bool); //compress or not
-    uint32 item_count = m_items.size();
-    for(uint32 i = 0 ; i < item_count ; i ++){
-        _size += __CACHE_NAME_SIZE;
+    _size += sizeof(uint64) + sizeof(uint32); //max_frag_size + block_size
+    _size += sizeof(uint64) + namesSize; //string table
+    for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+        if(m_items[i].removed){
+            continue;
+        }
+        _size += sizeof(uint32) * 2; //name offset + name length
         _size += (sizeof(uint32) + sizeof(uint64) * 2);  //flags + raw_size + frag_offset
         _size += sizeof(int); //id count
         _size += m_items[i].frag_ids.size() * sizeof(uint32); //all ids
+        if(m_items[i].flags & kFlag_HASHED){
+            _size += sizeof(uint64);
+        }
+    }
+    for(uint32 i = 0 ; i < (uint32)m_data.size() ; i ++){
+        _size += sizeof(uint64) + sizeof(uint32); //raw_size + block count
+        _size += (i < tables.size() ? tables[i].size() : 0) * sizeof(uint64); //block ends
     }
+    _size += sizeof(uint32) + (m_items.size() - m_removedCount) * sizeof(uint32); //key directory
     return _size;
 }
-void CacheManager::writeRecordFile(CString _file, bool compressed){
-    //write record
-    uint32 item_count = m_items.size();
-    uint32 block_count = m_data.size();
+void CacheManager::writeRecordFile(CString _file, bool compressed,
+                                   uint32 blockSize, const FragBlockTables& tables){
     std::vector<char> _buffer;
-    _buffer.resize(computeRecordSize());
+    buildRecord(compressed, blockSize, tables, _buffer);
+    //write
+    FILE* stream_out = fopen64(_file.data(), "wb");
+    fwrite(_buffer.data(), 1, _buffer.size(), stream_out);
+    fflush(stream_out);
+    fclose(stream_out);
+}
+void CacheManager::buildRecord(bool compressed, uint32 blockSize, const FragBlockTables& tables,
+                               std::vector<char>& _buffer){
+    uint32 magic = __CACHE_RECORD_MAGIC;
+    uint32 version = __CACHE_RECORD_VERSION;
+    //removed items are not written, their data is left in the fragments.
+    uint32 item_count = m_items.size() - m_removedCount;
+    uint32 block_count = m_data.size();
+    //string table: all names, null terminated.
+    uint64 names_size = 0;
+    for(auto& item : m_items){
+        if(!item.removed){
+            names_size += item.name_len + 1;
+        }
+    }
+    MED_ASSERT_X(names_size <= 0xffffffffu, "the names are too large");
+    _buffer.resize(computeRecordSize(tables, names_size));
     //write count info
-    uint32 offset = 0;
-    memcpy(_buffer.data(), &item_count, sizeof(uint32));
+    uint64 offset = 0;
+    memcpy(_buffer.data(), &magic, sizeof(uint32));
+    offset += sizeof(uint32);
+    memcpy(_buffer.data() + offset, &version, sizeof(uint32));
+    offset += sizeof(uint32);
+    memcpy(_buffer.data() + offset, &item_count, sizeof(uint32));
     offset += sizeof(uint32);
     memcpy(_buffer.data() + offset, &block_count, sizeof(uint32));
     offset += sizeof(uint32);
     memcpy(_buffer.data() + offset, &compressed, sizeof(bool));
     offset += sizeof(bool);
+    memcpy(_buffer.data() + offset, &m_maxFragSize, sizeof(uint64));
+    offset += sizeof(uint64);
+    memcpy(_buffer.data() + offset, &blockSize, sizeof(uint32));
+    offset += sizeof(uint32);
+    memcpy(_buffer.data() + offset, &names_size, sizeof(uint64));
+    offset += sizeof(uint64);
+    const uint64 names_offset = offset;
+    offset += names_size;
     //
-    for(uint32 i = 0 ; i < item_count ; i ++){
-         //name
-         memcpy(_buffer.data() + offset, m_items[i].name, __CACHE_NAME_SIZE);
-         offset += __CACHE_NAME_SIZE;
+    uint32 name_pos = 0;
+    for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+         if(m_items[i].removed){
+             continue;
+         }
+         //name: offset in the string table, length.
+         memcpy(_buffer.data() + names_offset + name_pos, m_items[i].name, m_items[i].name_len + 1);
+         memcpy(_buffer.data() + offset, &name_pos, sizeof(uint32));
+         offset += sizeof(uint32);
+         memcpy(_buffer.data() + offset, &m_items[i].name_len, sizeof(uint32));
+         offset += sizeof(uint32);
+         name_pos += m_items[i].name_len + 1;
          //flags
          memcpy(_buffer.data() + offset, &m_items[i].flags, sizeof(uint32));
          offset += sizeof(uint32);
@@ -253,132 +638,901 @@ void CacheManager::writeRecordFile(CString _file, bool compressed){
          memcpy(_buffer.data() + offset, m_items[i].frag_ids.data(),
                 id_count * sizeof(uint32));
          offset += id_count * sizeof(uint32);
+         //hash
+         if(m_items[i].flags & kFlag_HASHED){
+             memcpy(_buffer.data() + offset, &m_items[i].hash, sizeof(uint64));
+             offset += sizeof(uint64);
+         }
     }
-    //write
-    FILE* stream_out = fopen64(_file.data(), "wb");
-    fwrite(_buffer.data(), 1, _buffer.size(), stream_out);
-    fflush(stream_out);
-    fclose(stream_out);
+    //fragments: raw size and the compressed block table.
+    for(uint32 i = 0 ; i < block_count ; i ++){
+        memcpy(_buffer.data() + offset, &m_data[i].size, sizeof(uint64));
+        offset += sizeof(uint64);
+        uint32 n = i < tables.size() ? tables[i].size() : 0;
+        memcpy(_buffer.data() + offset, &n, sizeof(uint32));
+        offset += sizeof(uint32);
+        if(n > 0){
+            memcpy(_buffer.data() + offset, tables[i].data(), n * sizeof(uint64));
+            offset += n * sizeof(uint64);
+        }
+    }
+    //key directory: item positions in the record, sorted by name.
+    {
+        std::vector<uint32> pos(m_items.size());
+        uint32 p = 0;
+        for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+            if(!m_items[i].removed){
+                pos[i] = p ++;
+            }
+        }
+        auto& ids = getSortedIds();
+        MED_ASSERT(ids.size() == item_count);
+        memcpy(_buffer.data() + offset, &item_count, sizeof(uint32));
+        offset += sizeof(uint32);
+        for(auto id : ids){
+            memcpy(_buffer.data() + offset, &pos[id], sizeof(uint32));
+            offset += sizeof(uint32);
+        }
+    }
+    MED_ASSERT(offset == _buffer.size());
 }
 
 void CacheManager::saveTo(CString dir,CString recordName, CString dataName){
+    WriteGuard g(m_rwLock);
     if(m_items.empty()){
         return;
     }
+    //the removed data is not written.
+    compact0(false);
     std::string outDir_pre = dir.empty() ? "" : dir + "/";
+    prepareOutFiles(outDir_pre + dataName, false, 0);
     for(uint32 i = 0 ; i < (uint32)m_data.size() ; i ++){
-        MED_ASSERT(!m_data[i].empty());
+        MED_ASSERT(m_data[i].size > 0);
         std::string out_file = outDir_pre + dataName + std::to_string(i) + ".dt";
+        auto& frag = m_data[i];
+        if(!frag.resident && !frag.compressed && frag.file->path() == out_file){
+            //lazy fragment of the same file, already up to date.
+            continue;
+        }
+        const char* frag_data = getFragData(i);
         FILE* stream_out = fopen64(out_file.data(), "wb");
-        fwrite(m_data[i].data(), 1, m_data[i].size(), stream_out);
+        fwrite(frag_data, 1, frag.size, stream_out);
         fflush(stream_out);
         fclose(stream_out);
     }
     //write record
     std::string out_file = outDir_pre + recordName + ".dr";
-    writeRecordFile(out_file, false);
+    writeRecordFile(out_file, false, 0, FragBlockTables());
 }
 
 void CacheManager::compressTo(CString dir,CString recordName, CString dataName){
+    WriteGuard g(m_rwLock);
+    compressTo0(dir, recordName, dataName);
+}
+void CacheManager::compressTo0(CString dir,CString recordName, CString dataName){
     if(m_items.empty()){
         return;
     }
+    //the removed data is not written.
+    compact0(false);
     std::string outDir_pre = dir.empty() ? "" : dir + "/";
     uint32 block_count = m_data.size();
-    for(uint32 i = 0 ; i < block_count ; i ++){
-        MED_ASSERT(!m_data[i].empty());
+    const uint32 blockSize = m_blockSize;
+    prepareOutFiles(outDir_pre + dataName, true, blockSize);
+    //every task only holds the compressed data of its current fragment.
+    FragBlockTables tables(block_count);
+    runFragTasks(m_threadCount, block_count, [this, &outDir_pre, &dataName, &tables, blockSize](int i){
+        MED_ASSERT(m_data[i].size > 0);
         std::string out_file = outDir_pre + dataName + std::to_string(i) + ".dt";
-        std::string real_data;
-        auto _csize = snappy::Compress(m_data[i].data(), m_data[i].size(), &real_data);
-        MED_ASSERT(_csize == real_data.length());
-        FILE* stream_out = fopen64(out_file.data(), "wb");
-        fwrite(real_data.data(), 1, _csize, stream_out);
-        fflush(stream_out);
-        fclose(stream_out);
-    }
+        auto& frag = m_data[i];
+        if(!frag.resident && frag.compressed && frag.block_size == blockSize){
+            //lazy fragment is still the compressed file content.
+            tables[i] = frag.block_ends;
+            if(frag.file->path() == out_file){
+                return true;
+            }
+            FILE* stream_out = fopen64(out_file.data(), "wb");
+            fwrite(fileData(frag), 1, frag.file_size, stream_out);
+            fflush(stream_out);
+            fclose(stream_out);
+            return true;
+        }
+        writeCompressedFrag(i, out_file, blockSize, tables[i]);
+        return true;
+    });
     //write record
     std::string out_file = outDir_pre + recordName + ".dr";
-    writeRecordFile(out_file, true);
+    writeRecordFile(out_file, true, blockSize, tables);
 }
 
-bool CacheManager::load(CString dir,CString recordName, CString dataName){
-     std::string outDir_pre = dir.empty() ? "" : dir + "/";
-     std::string rfile = outDir_pre + recordName + ".dr";
-     std::vector<char> _buffer;
-     readBigFile(rfile, _buffer);
-     if(_buffer.empty()){
-         return false;
-     }
-     //
+void CacheManager::writeCompressedFrag(uint32 id, CString out_file, uint32 blockSize,
+                                       std::vector<uint64>& block_ends, int tc){
+    std::string real_data;
+    compressFrag(id, blockSize, real_data, block_ends, tc);
+    FILE* stream_out = fopen64(out_file.data(), "wb");
+    fwrite(real_data.data(), 1, real_data.length(), stream_out);
+    fflush(stream_out);
+    fclose(stream_out);
+}
+void CacheManager::compressFrag(uint32 id, uint32 blockSize, std::string& real_data,
+                                std::vector<uint64>& block_ends, int tc){
+    auto& frag = m_data[id];
+    const char* frag_data = getFragData(id);
+    const uint64 block_count = blockSize > 0 ? (frag.size + blockSize - 1) / blockSize : 0;
+    if(blockSize == 0){
+        auto _csize = snappy::Compress(frag_data, frag.size, &real_data);
+        MED_ASSERT(_csize == real_data.length());
+    }else if(tc > 1 && block_count > 1){
+        //blocks are independent, compress them on the pool and join in order.
+        std::vector<std::string> blocks(block_count);
+        runFragTasks(tc, block_count, [&blocks, &frag, frag_data, blockSize](int b){
+            uint64 pos = (uint64)b * blockSize;
+            uint64 _size = HMIN(frag.size - pos, (uint64)blockSize);
+            snappy::Compress(frag_data + pos, _size, &blocks[b]);
+            return true;
+        });
+        for(auto& block_data : blocks){
+            real_data.append(block_data);
+            block_ends.push_back(real_data.length());
+        }
+    }else{
+        //frag_data may be mapped from the output file, so compress all blocks before opening it.
+        std::string block_data;
+        uint64 pos = 0;
+        while (pos < frag.size) {
+            uint64 _size = HMIN(frag.size - pos, (uint64)blockSize);
+            auto _csize = snappy::Compress(frag_data + pos, _size, &block_data);
+            real_data.append(block_data.data(), _csize);
+            block_ends.push_back(real_data.length());
+            pos += _size;
+        }
+    }
+}
+
+bool CacheManager::packTo(CString file, bool compress){
+    WriteGuard g(m_rwLock);
+    if(m_items.empty()){
+        return false;
+    }
+    //the removed data is not written.
+    compact0(false);
+    //fragments mapped from the old pack are loaded before it is overwritten.
+    for(uint32 i = 0 ; i < (uint32)m_data.size() ; i ++){
+        if(!m_data[i].resident && m_data[i].file->path() == file){
+            getResidentFrag(i);
+        }
+    }
+    FILE* stream_out = fopen64(file.data(), "wb");
+    if(stream_out == NULL){
+        fprintf(stderr, "CacheManager::packTo >> open file failed: %s\n", file.data());
+        return false;
+    }
+    const uint32 block_count = m_data.size();
+    const uint32 blockSize = compress ? m_blockSize : 0;
+    std::vector<uint64> table(block_count * 2, 0); //offset, size
+    FragBlockTables tables(block_count);
+    //header and fragment table are written at last.
+    uint64 pos = __CACHE_PACK_HEADER_SIZE + table.size() * sizeof(uint64);
+    {
+        std::vector<char> zeros(pos, 0);
+        fwrite(zeros.data(), 1, zeros.size(), stream_out);
+    }
+    //compress a batch of fragments in parallel, then write them in order.
+    const uint32 batch = m_threadCount > 1 ? m_threadCount : 1;
+    std::vector<std::string> datas(batch);
+    for(uint32 start = 0 ; start < block_count ; start += batch){
+        const uint32 n = HMIN(batch, block_count - start);
+        if(compress){
+            runFragTasks(m_threadCount, n, [this, start, blockSize, &datas, &tables](int k){
+                uint32 i = start + k;
+                auto& frag = m_data[i];
+                datas[k].clear();
+                if(!frag.resident && frag.compressed && frag.block_size == blockSize){
+                    //still the compressed data.
+                    datas[k].assign(fileData(frag), frag.file_size);
+                    tables[i] = frag.block_ends;
+                }else{
+                    compressFrag(i, blockSize, datas[k], tables[i]);
+                }
+                return true;
+            });
+        }
+        for(uint32 k = 0 ; k < n ; ++k){
+            uint32 i = start + k;
+            const char* data = compress ? datas[k].data() : getFragData(i);
+            uint64 size = compress ? datas[k].length() : m_data[i].size;
+            //fragments start at aligned offsets, so they can be mapped alone.
+            uint64 aligned = (pos + __CACHE_PACK_ALIGN - 1) / __CACHE_PACK_ALIGN * __CACHE_PACK_ALIGN;
+            if(aligned > pos){
+                std::vector<char> zeros(aligned - pos, 0);
+                fwrite(zeros.data(), 1, zeros.size(), stream_out);
+            }
+            fwrite(data, 1, size, stream_out);
+            table[i * 2] = aligned;
+            table[i * 2 + 1] = size;
+            pos = aligned + size;
+        }
+    }
+    //record
+    std::vector<char> record;
+    buildRecord(compress, blockSize, tables, record);
+    fwrite(record.data(), 1, record.size(), stream_out);
+    //header: magic, version, fragment count, 4 reserved bytes, record offset, record size.
+    char header[__CACHE_PACK_HEADER_SIZE] = {0};
+    uint32 magic = __CACHE_PACK_MAGIC;
+    uint32 version = __CACHE_PACK_VERSION;
+    uint64 record_size = record.size();
+    memcpy(header, &magic, sizeof(uint32));
+    memcpy(header + 4, &version, sizeof(uint32));
+    memcpy(header + 8, &block_count, sizeof(uint32));
+    memcpy(header + 16, &pos, sizeof(uint64));
+    memcpy(header + 24, &record_size, sizeof(uint64));
+    fseeko64(stream_out, 0, SEEK_SET);
+    fwrite(header, 1, __CACHE_PACK_HEADER_SIZE, stream_out);
+    fwrite(table.data(), sizeof(uint64), table.size(), stream_out);
+    fflush(stream_out);
+    bool ok = ferror(stream_out) == 0;
+    fclose(stream_out);
+    return ok;
+}
+bool CacheManager::loadPack(CString file, bool lazy){
+    WriteGuard g(m_rwLock);
+    auto map = std::make_shared<MappedFile>();
+    if(!map->open(file) || map->size() < __CACHE_PACK_HEADER_SIZE){
+        fprintf(stderr, "CacheManager::loadPack >> map file failed: %s\n", file.data());
+        return false;
+    }
+    const char* base = map->data();
+    uint32 magic, version, block_count;
+    uint64 record_offset, record_size;
+    memcpy(&magic, base, sizeof(uint32));
+    memcpy(&version, base + 4, sizeof(uint32));
+    memcpy(&block_count, base + 8, sizeof(uint32));
+    memcpy(&record_offset, base + 16, sizeof(uint64));
+    memcpy(&record_size, base + 24, sizeof(uint64));
+    //everything from the file is checked against the mapped size, written as
+    //subtractions so a corrupt value can't overflow.
+    const uint64 table_end = __CACHE_PACK_HEADER_SIZE + (uint64)block_count * 2 * sizeof(uint64);
+    if(magic != __CACHE_PACK_MAGIC || version > __CACHE_PACK_VERSION
+            || record_offset > map->size() || record_size > map->size() - record_offset
+            || table_end > record_offset){
+        fprintf(stderr, "CacheManager::loadPack >> bad pack file: %s\n", file.data());
+        return false;
+    }
+    bool compressed;
+    if(!loadRecord(base + record_offset, record_size, compressed)){
+        return false;
+    }
+    auto badPack = [this, &file](){
+        fprintf(stderr, "CacheManager::loadPack >> bad pack file: %s\n", file.data());
+        reset0();
+        return false;
+    };
+    if(block_count != m_data.size()){
+        return badPack();
+    }
+    const char* table = base + __CACHE_PACK_HEADER_SIZE;
+    for(uint32 i = 0 ; i < block_count ; i ++){
+        auto& frag = m_data[i];
+        memcpy(&frag.file_offset, table + i * 2 * sizeof(uint64), sizeof(uint64));
+        memcpy(&frag.file_size, table + (i * 2 + 1) * sizeof(uint64), sizeof(uint64));
+        if(frag.file_offset < table_end || frag.file_offset > record_offset
+                || frag.file_size > record_offset - frag.file_offset){
+            return badPack();
+        }
+        if(compressed && frag.block_size > 0){
+            uint64 prev = 0;
+            for(auto end : frag.block_ends){
+                if(end < prev || end > frag.file_size){
+                    return badPack();
+                }
+                prev = end;
+            }
+        }
+        frag.file = map;
+        frag.compressed = compressed;
+        frag.resident = false;
+        if(frag.block_size == 0){
+            if(compressed){
+                size_t _rawSize = 0;
+                if(!snappy::GetUncompressedLength(fileData(frag), frag.file_size, &_rawSize)){
+                    return badPack();
+                }
+                frag.size = _rawSize;
+            }else{
+                frag.size = frag.file_size;
+            }
+        }
+    }
+    if(lazy){
+        return true;
+    }
+    //the mapping is released after all fragments are loaded.
+    return runFragTasks(m_threadCount, block_count, [this](int i){
+        getResidentFrag(i);
+        return true;
+    });
+}
+
+bool CacheManager::beginStream(CString dir,CString recordName, CString dataName){
+    WriteGuard g(m_rwLock);
+    if(!m_items.empty() || !m_data.empty()){
+        fprintf(stderr, "CacheManager::beginStream >> the manager must be empty.\n");
+        return false;
+    }
+    m_streamDir = dir;
+    m_streamRecord = recordName;
+    m_streamData = dataName;
+    m_streaming = true;
+    return true;
+}
+void CacheManager::flushFragment(uint32 id){
+    std::string outDir_pre = m_streamDir.empty() ? "" : m_streamDir + "/";
+    std::string out_file = outDir_pre + m_streamData + std::to_string(id) + ".dt";
+    auto& frag = m_data[id];
+    std::vector<uint64> block_ends;
+    //the fragments are flushed one by one, so the pool is used by its blocks.
+    writeCompressedFrag(id, out_file, m_blockSize, block_ends, m_threadCount);
+    //keep it like a lazy loaded fragment, it can still be read.
+    auto file = std::make_shared<MappedFile>();
+    MED_ASSERT_X(file->open(out_file), out_file);
+    frag.data = nullptr;
+    frag.file_offset = 0;
+    frag.file_size = file->size();
+    frag.file = std::move(file);
+    frag.resident = false;
+    frag.compressed = true;
+    frag.block_size = m_blockSize;
+    frag.block_ends = std::move(block_ends);
+}
+void CacheManager::endStream(){
+    WriteGuard g(m_rwLock);
+    if(!m_streaming){
+        return;
+    }
+    m_streaming = false;
+    //the flushed fragments are kept, only the last one is written.
+    compressTo0(m_streamDir, m_streamRecord, m_streamData);
+}
+
+bool CacheManager::loadRecord(const char* _buffer, uint64 _bufSize, bool& compressed){
+     //every read and count is checked against the buffer, a corrupt record
+     //fails the load instead of reading past it.
      uint64 offset = 0;
+     auto read = [_buffer, _bufSize, &offset](void* dst, uint64 len){
+         if(len > _bufSize - offset){
+             return false;
+         }
+         memcpy(dst, _buffer + offset, len);
+         offset += len;
+         return true;
+     };
+     auto left = [_bufSize, &offset](){
+         return _bufSize - offset;
+     };
+     auto badRecord = [this](const char* msg){
+         fprintf(stderr, "CacheManager::load >> bad record: %s\n", msg);
+         reset0();
+         return false;
+     };
+     uint32 version = 1;
      uint32 block_count;
      uint32 item_count;
-     bool compressed;
-     memcpy(&item_count, _buffer.data(), sizeof(uint32));
-     offset += sizeof(uint32);
-     memcpy(&block_count, _buffer.data() + offset, sizeof(uint32));
-     offset += sizeof(uint32);
-     memcpy(&compressed, _buffer.data() + offset, sizeof(bool));
-     offset += sizeof(bool);
+     uint32 block_size = 0;
+     if(!read(&item_count, sizeof(uint32))){
+         return badRecord("truncated header");
+     }
+     if(item_count == __CACHE_RECORD_MAGIC){
+         if(!read(&version, sizeof(uint32))){
+             return badRecord("truncated header");
+         }
+         if(version > __CACHE_RECORD_VERSION){
+             fprintf(stderr, "CacheManager::load >> unsupported record version: %u\n", version);
+             return false;
+         }
+         if(!read(&item_count, sizeof(uint32))){
+             return badRecord("truncated header");
+         }
+     }
+     unsigned char compressFlag;
+     if(!read(&block_count, sizeof(uint32)) || !read(&compressFlag, sizeof(bool))){
+         return badRecord("truncated header");
+     }
+     compressed = compressFlag != 0;
+     uint64 maxFragSize = m_maxFragSize;
+     if(version >= 2){
+         if(!read(&maxFragSize, sizeof(uint64)) || !read(&block_size, sizeof(uint32))){
+             return badRecord("truncated header");
+         }
+     }
      //no flag
+     reset0();
+     m_maxFragSize = maxFragSize;
+     //string table, kept in one block.
+     const char* names = nullptr;
+     uint64 names_size = 0;
+     if(version >= 4){
+         if(!read(&names_size, sizeof(uint64)) || names_size > left()){
+             return badRecord("string table");
+         }
+         std::unique_ptr<char[]> block(new char[names_size]);
+         read(block.get(), names_size);
+         names = m_names.adopt(std::move(block));
+     }
+     //the least bytes of an item and a fragment, to bound the counts.
+     const uint64 minItemSize = (version >= 4 ? 2 * sizeof(uint32) : __CACHE_NAME_SIZE)
+             + sizeof(uint32) + 2 * sizeof(uint64) + sizeof(int);
+     const uint64 minFragSize = version >= 2 ? sizeof(uint64) + sizeof(uint32) : 0;
+     if((uint64)item_count * minItemSize + (uint64)block_count * minFragSize > left()){
+         return badRecord("item or fragment count");
+     }
      m_items.resize(item_count);
      int id_count;
      for(uint32 i = 0 ; i < item_count ; i ++){
          //name, flags, raw_size, frag_offset, ids
-        memcpy(m_items[i].name, _buffer.data() + offset, __CACHE_NAME_SIZE);
-        offset += __CACHE_NAME_SIZE;
-        memcpy(&m_items[i].flags, _buffer.data() + offset, sizeof(uint32));
-        offset += sizeof(uint32);
-        memcpy(&m_items[i].raw_size, _buffer.data() + offset, sizeof(uint64));
-        offset += sizeof(uint64);
-        memcpy(&m_items[i].frag_offset, _buffer.data() + offset, sizeof(uint64));
-        offset += sizeof(uint64);
-        //
-        memcpy(&id_count, _buffer.data() + offset, sizeof(int));
-        offset += sizeof(int);
-        m_items[i].frag_ids.resize(id_count);
-        memcpy(m_items[i].frag_ids.data(), _buffer.data() + offset,
-               id_count * sizeof(uint32));
-        offset += id_count * sizeof(uint32);
+        auto& item = m_items[i];
+        if(version >= 4){
+            uint32 name_pos;
+            if(!read(&name_pos, sizeof(uint32)) || !read(&item.name_len, sizeof(uint32))
+                    || (uint64)name_pos + item.name_len >= names_size
+                    || names[name_pos + item.name_len] != '\0'){
+                return badRecord("item name");
+            }
+            item.name = names + name_pos;
+        }else{
+            if(left() < __CACHE_NAME_SIZE){
+                return badRecord("item name");
+            }
+            const char* name = _buffer + offset;
+            item.name_len = strnlen(name, __CACHE_NAME_SIZE);
+            item.name = m_names.add(name, item.name_len);
+            offset += __CACHE_NAME_SIZE;
+        }
+        if(!read(&item.flags, sizeof(uint32)) || !read(&item.raw_size, sizeof(uint64))
+                || !read(&item.frag_offset, sizeof(uint64)) || !read(&id_count, sizeof(int))
+                || id_count < 0 || (uint64)id_count * sizeof(uint32) > left()){
+            return badRecord("item");
+        }
+        item.frag_ids.resize(id_count);
+        read(item.frag_ids.data(), id_count * sizeof(uint32));
+        for(auto id : item.frag_ids){
+            if(id >= block_count){
+                return badRecord("item fragment id");
+            }
+        }
+        if(version >= 3 && (item.flags & kFlag_HASHED)){
+            if(!read(&item.hash, sizeof(uint64))){
+                return badRecord("item hash");
+            }
+        }else{
+            item.flags &= ~kFlag_HASHED;
+        }
      }
+     rebuildIndex();
      //data file
+     m_data.clear();
      m_data.resize(block_count);
-     for(uint32 i = 0 ; i < block_count ; i ++){
+     if(version >= 2){
+         for(uint32 i = 0 ; i < block_count ; i ++){
+             auto& frag = m_data[i];
+             uint32 n;
+             if(!read(&frag.size, sizeof(uint64)) || !read(&n, sizeof(uint32))
+                     || (uint64)n * sizeof(uint64) > left() || (n > 0 && block_size == 0)){
+                 return badRecord("fragment");
+             }
+             frag.block_ends.resize(n);
+             read(frag.block_ends.data(), n * sizeof(uint64));
+             frag.block_size = n > 0 ? block_size : 0;
+         }
+     }
+     //sorted key directory, or built on need.
+     if(version >= 5){
+         uint32 n;
+         if(!read(&n, sizeof(uint32)) || n != item_count
+                 || (uint64)n * sizeof(uint32) > left()){
+             return badRecord("key directory");
+         }
+         m_sortedIds.resize(n);
+         read(m_sortedIds.data(), n * sizeof(uint32));
+         for(auto id : m_sortedIds){
+             if(id >= item_count){
+                 return badRecord("key directory");
+             }
+         }
+     }
+     return true;
+}
+bool CacheManager::load(CString dir,CString recordName, CString dataName, bool lazy){
+    WriteGuard g(m_rwLock);
+     std::string outDir_pre = dir.empty() ? "" : dir + "/";
+     std::string rfile = outDir_pre + recordName + ".dr";
+     std::vector<char> _buffer;
+     readBigFile(rfile, _buffer);
+     if(_buffer.empty()){
+         return false;
+     }
+     bool compressed;
+     if(!loadRecord(_buffer.data(), _buffer.size(), compressed)){
+         return false;
+     }
+     uint32 block_count = m_data.size();
+     return runFragTasks(lazy ? 1 : m_threadCount, block_count,
+                         [this, &outDir_pre, &dataName, lazy, compressed](int i){
          std::string out_file = outDir_pre + dataName + std::to_string(i) + ".dt";
-         if(compressed){
+         auto& frag = m_data[i];
+         if(lazy){
+             frag.file = std::make_shared<MappedFile>();
+             if(!frag.file->open(out_file)){
+                 fprintf(stderr, "CacheManager::load >> map file failed: %s\n", out_file.data());
+                 return false;
+             }
+             frag.compressed = compressed;
+             frag.resident = false;
+             frag.file_size = frag.file->size();
+             //block mode has the raw size in the record.
+             if(frag.block_size == 0){
+                 if(compressed){
+                     size_t _rawSize = 0;
+                     MED_ASSERT(snappy::GetUncompressedLength(fileData(frag),
+                                                             frag.file_size, &_rawSize));
+                     frag.size = _rawSize;
+                 }else{
+                     frag.size = frag.file_size;
+                 }
+             }
+         }else if(compressed){
              std::vector<char> vec;
              readBigFile(out_file, vec);
-
-             std::string str;
-             MED_ASSERT(snappy::Uncompress(vec.data(), vec.size(), &str));
-             m_data[i].resize(str.length());
-             memcpy(m_data[i].data(), str.data(), str.length());
+             if(frag.block_size > 0){
+                 //independent blocks.
+                 frag.data = std::make_shared<std::vector<char>>(frag.size);
+                 uint64 pos = 0;
+                 uint64 begin = 0;
+                 for(auto end : frag.block_ends){
+                     size_t _rawSize = 0;
+                     MED_ASSERT(snappy::GetUncompressedLength(vec.data() + begin, end - begin, &_rawSize));
+                     MED_ASSERT(pos + _rawSize <= frag.size);
+                     MED_ASSERT(snappy::RawUncompress(vec.data() + begin, end - begin,
+                                                      frag.data->data() + pos));
+                     pos += _rawSize;
+                     begin = end;
+                 }
+                 MED_ASSERT(pos == frag.size);
+                 frag.block_size = 0;
+                 frag.block_ends.clear();
+             }else{
+                 size_t _rawSize = 0;
+                 MED_ASSERT(snappy::GetUncompressedLength(vec.data(), vec.size(), &_rawSize));
+                 frag.data = std::make_shared<std::vector<char>>(_rawSize);
+                 MED_ASSERT(snappy::RawUncompress(vec.data(), vec.size(), frag.data->data()));
+                 frag.size = _rawSize;
+             }
          }else{
-             readBigFile(out_file, m_data[i]);
+             frag.data = std::make_shared<std::vector<char>>();
+             readBigFile(out_file, *frag.data);
+             frag.size = frag.data->size();
          }
-     }
-     return true;
+         return true;
+     });
 }
 //-------------------------
 void CacheManager::getItemData0(int _idx, std::string& out){
-    Item* _item = &m_items[_idx];
-    out.resize(_item->raw_size);
+    std::vector<DataSlice> slices;
+    //cached blocks may be evicted while the later slices are read.
+    std::vector<std::shared_ptr<const void>> pins;
+    getItemSlices(_idx, slices, &pins);
+    out.resize(m_items[_idx].raw_size);
     //
     uint64 ptr_offset = 0;
+    for(auto& slice : slices){
+        memcpy((void*)(out.data() + ptr_offset), slice.data, slice.len);
+        ptr_offset += slice.len;
+    }
+    if(!checkItemHash(_idx, out)){
+        fprintf(stderr, "CacheManager >> item hash mismatch: %s\n", m_items[_idx].name);
+        out.clear();
+    }
+}
+bool CacheManager::checkItemHash(int _idx, const std::string& data){
+    auto& item = m_items[_idx];
+    if((item.flags & kFlag_HASHED) == 0){
+        return true;
+    }
+    ChunkHasher hasher;
+    hasher.update(data.data(), data.length());
+    return hasher.digest() == item.hash;
+}
+bool CacheManager::checkItemHash(int _idx, const std::vector<DataSlice>& slices){
+    auto& item = m_items[_idx];
+    if((item.flags & kFlag_HASHED) == 0){
+        return true;
+    }
+    //hash the slices, no copy of the item.
+    ChunkHasher hasher;
+    for(auto& slice : slices){
+        hasher.update(slice.data, slice.len);
+    }
+    return hasher.digest() == item.hash;
+}
+uint32 CacheManager::prefetch(const std::vector<std::string>& names){
+    ReadGuard g(m_rwLock);
+    std::vector<int> ids;
+    ids.reserve(names.size());
+    for(auto& name : names){
+        int _idx = getItemByName(name);
+        if(_idx >= 0){
+            ids.push_back(_idx);
+        }
+    }
+    const uint64 budget = m_blockCache.getBudget();
+    runFragTasks(m_threadCount, ids.size(), [this, &ids, budget](int k){
+        //slices of lazy fragments are uncompressed on get.
+        std::vector<DataSlice> slices;
+        std::vector<std::shared_ptr<const void>> pins;
+        auto& item = m_items[ids[k]];
+        uint64 left_size = item.raw_size;
+        uint64 start = item.frag_offset;
+        for(auto id: item.frag_ids){
+            auto& frag = m_data[id];
+            auto _size = HMIN(left_size, frag.size - start);
+            //a one stream bigger than the budget is not kept, don't uncompress it for nothing.
+            if(frag.resident || !frag.compressed || frag.block_size > 0
+                    || frag.size <= budget){
+                getFragSlices(id, start, _size, slices, &pins);
+            }
+            left_size -= _size;
+            start = 0;
+        }
+        //fault in the mapped pages.
+        volatile char sink = 0;
+        for(auto& slice : slices){
+            for(uint64 off = 0 ; off < slice.len ; off += __CACHE_PAGE_SIZE){
+                sink = sink ^ slice.data[off];
+            }
+        }
+        (void)sink;
+        return true;
+    });
+    return ids.size();
+}
+bool CacheManager::verifyAll(std::vector<String>* badNames){
+    ReadGuard g(m_rwLock);
+    std::vector<char> bad(m_items.size(), 0);
+    runFragTasks(m_threadCount, m_items.size(), [this, &bad](int i){
+        auto& item = m_items[i];
+        if(item.removed || (item.flags & kFlag_HASHED) == 0){
+            return true;
+        }
+        std::vector<DataSlice> slices;
+        std::vector<std::shared_ptr<const void>> pins;
+        getItemSlices(i, slices, &pins);
+        bad[i] = !checkItemHash(i, slices);
+        return true;
+    });
+    bool ok = true;
+    for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+        if(bad[i]){
+            ok = false;
+            fprintf(stderr, "CacheManager::verifyAll >> item hash mismatch: %s\n", m_items[i].name);
+            if(badNames){
+                badNames->emplace_back(m_items[i].name, m_items[i].name_len);
+            }
+        }
+    }
+    return ok;
+}
+void CacheManager::getItemSlices(int _idx, std::vector<DataSlice>& out,
+                                 std::vector<std::shared_ptr<const void>>* pins){
+    Item* _item = &m_items[_idx];
+    out.clear();
+    out.reserve(_item->frag_ids.size());
+    //
     uint64 left_size = _item->raw_size;
-    bool first = true;
+    uint64 start = _item->frag_offset;
     for(auto id: _item->frag_ids){
-        if(first){
-            first = false;
-            auto _size = HMIN(left_size, m_maxFragSize - _item->frag_offset);
-            memcpy((void*)(out.data() + ptr_offset), m_data[id].data() + _item->frag_offset, _size);
-            left_size -= _size;
-            ptr_offset += _size;
+        //only the fragments the item touches are loaded.
+        auto _size = HMIN(left_size, m_data[id].size - start);
+        getFragSlices(id, start, _size, out, pins);
+        left_size -= _size;
+        start = 0;
+    }
+}
+void CacheManager::getFragSlices(uint32 id, uint64 start, uint64 len,
+                                 std::vector<DataSlice>& out,
+                                 std::vector<std::shared_ptr<const void>>* pins){
+    auto& frag = m_data[id];
+    if(frag.resident || !frag.compressed){
+        out.push_back({getFragData(id) + start, len});
+        if(pins){
+            pins->push_back(getFragPin(id));
+        }
+        return;
+    }
+    //one stream is uncompressed whole, and cached as one block charged at its size.
+    if(frag.block_size == 0){
+        auto whole = getWholeFrag(id);
+        out.push_back({whole->data() + start, len});
+        if(pins){
+            pins->push_back(whole);
+        }
+        return;
+    }
+    //only the blocks overlap the range.
+    const uint64 bs = frag.block_size;
+    uint32 b = start / bs;
+    while (len > 0) {
+        auto block = getFragBlock(id, b);
+        uint64 off = start - (uint64)b * bs;
+        auto _size = HMIN(len, (uint64)block->size() - off);
+        out.push_back({block->data() + off, _size});
+        if(pins){
+            pins->push_back(block);
+        }
+        start += _size;
+        len -= _size;
+        b ++;
+    }
+}
+std::shared_ptr<std::vector<char>> CacheManager::getFragBlock(uint32 id, uint32 b){
+    std::shared_ptr<std::vector<char>> block;
+    uint64 key = ((uint64)id << 32) | b;
+    if(m_blockCache.get(key, block)){
+        return block;
+    }
+    auto& frag = m_data[id];
+    uint64 begin = b > 0 ? frag.block_ends[b - 1] : 0;
+    uint64 len = frag.block_ends[b] - begin;
+    const char* src = fileData(frag) + begin;
+    size_t _rawSize = 0;
+    MED_ASSERT(snappy::GetUncompressedLength(src, len, &_rawSize));
+    block = std::make_shared<std::vector<char>>(_rawSize);
+    MED_ASSERT_X(snappy::RawUncompress(src, len, block->data()), frag.file->path());
+    m_blockCache.put(key, block, _rawSize);
+    return block;
+}
+std::shared_ptr<std::vector<char>> CacheManager::getWholeFrag(uint32 id){
+    std::shared_ptr<std::vector<char>> whole;
+    uint64 key = ((uint64)id << 32) | __CACHE_WHOLE_BLOCK;
+    if(m_blockCache.get(key, whole)){
+        return whole;
+    }
+    auto& frag = m_data[id];
+    size_t _rawSize = 0;
+    MED_ASSERT(snappy::GetUncompressedLength(fileData(frag), frag.file_size, &_rawSize));
+    whole = std::make_shared<std::vector<char>>(_rawSize);
+    MED_ASSERT_X(snappy::RawUncompress(fileData(frag), frag.file_size, whole->data()),
+                 frag.file->path());
+    m_blockCache.put(key, whole, _rawSize);
+    return whole;
+}
+bool CacheManager::getItemView(CString name, ItemView& out, bool verify){
+    ReadGuard g(m_rwLock);
+    auto _idx = getItemByName(name);
+    if(_idx < 0){
+        return false;
+    }
+    auto pins = std::make_shared<std::vector<std::shared_ptr<const void>>>();
+    getItemSlices(_idx, out.slices, pins.get());
+    out.size = m_items[_idx].raw_size;
+    if(verify && !checkItemHash(_idx, out.slices)){
+        fprintf(stderr, "CacheManager >> item hash mismatch: %s\n", m_items[_idx].name);
+        out = ItemView();
+        return false;
+    }
+    if(pins->size() == 1){
+        out.pin = (*pins)[0];
+    }else{
+        out.pin = pins;
+    }
+    return true;
+}
+bool CacheManager::loadFragment(Fragment& frag){
+    if(frag.resident){
+        return true;
+    }
+    if(!frag.compressed){
+        //the mapping is the data, pages are loaded on touch.
+        return true;
+    }
+    auto data = std::make_shared<std::vector<char>>(frag.size);
+    if(frag.block_size > 0){
+        uint64 pos = 0;
+        uint64 begin = 0;
+        for(uint32 b = 0 ; b < (uint32)frag.block_ends.size() ; ++b){
+            uint64 end = frag.block_ends[b];
+            size_t _rawSize = 0;
+            const char* src = fileData(frag) + begin;
+            MED_ASSERT(snappy::GetUncompressedLength(src, end - begin, &_rawSize));
+            MED_ASSERT(pos + _rawSize <= frag.size);
+            if(!snappy::RawUncompress(src, end - begin, data->data() + pos)){
+                fprintf(stderr, "CacheManager >> uncompress failed: %s\n", frag.file->path().data());
+                return false;
+            }
+            pos += _rawSize;
+            begin = end;
+        }
+        frag.block_ends.clear();
+        frag.block_size = 0;
+    }else if(!snappy::RawUncompress(fileData(frag), frag.file_size, data->data())){
+        fprintf(stderr, "CacheManager >> uncompress failed: %s\n", frag.file->path().data());
+        return false;
+    }
+    frag.data = std::move(data);
+    frag.resident = true;
+    frag.file = nullptr;
+    return true;
+}
+const char* CacheManager::fileData(const Fragment& frag){
+    return frag.file->data() + frag.file_offset;
+}
+const char* CacheManager::getFragData(uint32 id){
+    auto& frag = m_data[id];
+    MED_ASSERT(loadFragment(frag));
+    return frag.resident ? frag.data->data() : fileData(frag);
+}
+std::vector<char>& CacheManager::getResidentFrag(uint32 id){
+    auto& frag = m_data[id];
+    if(!frag.resident){
+        if(frag.compressed){
+            MED_ASSERT(loadFragment(frag));
         }else{
-            auto _size = HMIN(left_size, m_maxFragSize);
-            memcpy((void*)(out.data() + ptr_offset), m_data[id].data(), _size);
-            left_size -= _size;
-            ptr_offset += _size;
+            frag.data = std::make_shared<std::vector<char>>(fileData(frag),
+                                                           fileData(frag) + frag.size);
+            frag.resident = true;
+            frag.file = nullptr;
+        }
+    }else if(frag.data.use_count() > 1){
+        //views still hold the old data.
+        frag.data = std::make_shared<std::vector<char>>(*frag.data);
+    }
+    return *frag.data;
+}
+std::shared_ptr<const void> CacheManager::getFragPin(uint32 id){
+    auto& frag = m_data[id];
+    if(frag.resident){
+        return frag.data;
+    }
+    return frag.file;
+}
+void CacheManager::prepareOutFiles(CString dataPrefix, bool compress,
+                                   uint32 blockSize){
+    //a lazy fragment mapped from a file which will be overwritten must be
+    //loaded first. unless it is its own file and the content is unchanged, or
+    //the same content of a later file(ids move down by 'compact'): that one is
+    //copied to its own file in id order and mapped again, before its old file
+    //is overwritten.
+    std::unordered_map<std::string, uint32> outIds;
+    for(uint32 i = 0 ; i < (uint32)m_data.size() ; i ++){
+        outIds.emplace(dataPrefix + std::to_string(i) + ".dt", i);
+    }
+    std::vector<uint32> copies;
+    for(uint32 i = 0 ; i < (uint32)m_data.size() ; i ++){
+        auto& frag = m_data[i];
+        if(frag.resident){
+            continue;
+        }
+        auto it = outIds.find(frag.file->path());
+        if(it == outIds.end()){
+            continue;
         }
+        const bool same = compress ? (frag.compressed && frag.block_size == blockSize)
+                                   : !frag.compressed;
+        if(same && it->second > i){
+            copies.push_back(i);
+        }else if(!same || it->second < i){
+            getResidentFrag(i);
+        }
+    }
+    for(auto i : copies){
+        auto& frag = m_data[i];
+        std::string out_file = dataPrefix + std::to_string(i) + ".dt";
+        FILE* stream_out = fopen64(out_file.data(), "wb");
+        fwrite(fileData(frag), 1, frag.file_size, stream_out);
+        fflush(stream_out);
+        fclose(stream_out);
+        auto file = std::make_shared<MappedFile>();
+        MED_ASSERT_X(file->open(out_file), out_file);
+        frag.file = std::move(file);
+        frag.file_offset = 0;
     }
 }
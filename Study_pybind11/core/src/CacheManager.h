@@ -2,6 +2,14 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include "LruCache.h"
 
 namespace h7 {
 
@@ -10,10 +18,15 @@ using uint64 = unsigned long long;
 using String = std::string;
 using CString = const std::string&;
 
+    class MappedFile;
+
+    //reads(getItemXXX, getItemCount, getItemNames) can run concurrently from many threads.
+    //adds, removes, save and load take the manager exclusively.
     class CacheManager{
     public:
         enum{
-          kFlag_COMPRESSED = 0x1
+          kFlag_COMPRESSED = 0x1,
+          kFlag_HASHED = 0x2, //the record has the hash of the item data. see 'setItemHash'.
         };
        // using CString = const std::string&;
         CacheManager(uint64 maxFragSize):m_maxFragSize(maxFragSize){
@@ -32,6 +45,13 @@ using CString = const std::string&;
                      uint32 flags = 0);
 
         void addFileItem(const std::string& name, const std::string& filePath);
+        /**
+         * @brief addFileItems: like 'addFileItem' for every file, in order. the files are
+         *  read and hashed on the pool by batches of about '__CACHE_INGEST_BUDGET' bytes.
+         *  a bigger file is read alone by chunks.
+         */
+        void addFileItems(const std::vector<std::string>& names,
+                          const std::vector<std::string>& filePaths);
 
         void addItemCompressed(const std::string& name, const char* data, uint64 len);
 
@@ -41,15 +61,133 @@ using CString = const std::string&;
         void addFileItemCompressed(const std::string& name, const std::string& filePath);
 
         void getItemData(const std::string& name, std::string& out);
+        /**
+         * @brief prefetch: load the data of the items before they are read. lazy fragments
+         *  are uncompressed to the block cache (or as a whole), mapped pages are touched.
+         *  the warmed blocks are still bounded by the block cache budget. a one stream
+         *  fragment bigger than the budget is skipped, it would not be kept.
+         * @return the count of found items.
+         */
+        uint32 prefetch(const std::vector<std::string>& names);
+        //true if the item is added and not removed.
+        bool hasItem(const std::string& name){
+            ReadGuard g(m_rwLock);
+            return getItemByName(name) >= 0;
+        }
+
+        //a piece of item data, points into a fragment.
+        struct DataSlice{
+            const char* data;
+            uint64 len;
+        };
+        //the stored data of an item without copy. 'pin' keeps the memory of
+        //the slices valid, even after the item is removed or the manager is reset.
+        struct ItemView{
+            std::vector<DataSlice> slices; //one slice if the item is in one fragment.
+            std::shared_ptr<const void> pin;
+            uint64 size {0};
+
+            bool isContiguous()const{return slices.size() <= 1;}
+            //only valid if 'isContiguous'.
+            const char* data()const{return slices.empty() ? nullptr : slices[0].data;}
+        };
+        /**
+         * @brief getItemView: get the stored item data without copy. like 'getItemData',
+         *  compressed item is not uncompressed.
+         * @param name : the item name
+         * @param out : the view. items span fragments get one slice per fragment.
+         * @param verify : true to check the slices against the item hash(see 'setItemHash').
+         * @return true if the item exists(and matches its hash if verify).
+         */
+        bool getItemView(const std::string& name, ItemView& out, bool verify = false);
 
         void getItemDataUnCompressed(const std::string& name, std::string& out);
 
         void getItemAt(unsigned int index, std::string& o_name, std::string& o_data);
 
+        /**
+         * @brief removeItem: mark the first alive item of the name as removed in O(1). a later
+         *  item added with the same name is found by name next(found by a scan, only if any
+         *  name was added twice). its data stays in the fragments until 'compact' is called.
+         *  'saveTo', 'compressTo' and 'packTo'(and 'endStream') first rewrite the fragments
+         *  holding removed data, so it is never written. the other fragments are kept.
+         */
         void removeItem(const std::string& name);
+        //the data size of removed items and of the unused data shared by 'merge', which
+        //'compact' can free.
+        uint64 getFreeSize(){
+            ReadGuard g(m_rwLock);
+            return m_freeSize;
+        }
+        /**
+         * @brief compact: rewrite the fragments which hold free data with only their alive
+         *  data, once for many removes. the other fragments are kept, lazy ones are not
+         *  loaded. unlike the compaction before a save, it also drops the unused data of
+         *  the fragments shared by 'merge'.
+         */
+        void compact();
+        /**
+         * @brief merge: add the items of 'oth' whose names are not in this manager.
+         *  the fragments of 'oth' are shared, no item data is copied. the data of
+         *  items not taken is counted by 'getFreeSize'.
+         * @return the count of added items.
+         */
+        uint32 merge(CacheManager& oth);
 
+        //the count of alive items. 'getItemAt' indexes them in add order.
         uint32 getItemCount();
         std::vector<String> getItemNames();
+        /**
+         * @brief listPrefix: names of the alive items which start with 'prefix', in name
+         *  order. it is a binary search on the sorted key directory, O(log n + k). the
+         *  directory is saved in the record, or else built on the first query.
+         */
+        std::vector<String> listPrefix(const std::string& prefix);
+        //names in ['first', 'last') in name order. empty 'last' for no upper bound.
+        std::vector<String> listRange(const std::string& first, const std::string& last);
+
+        /**
+         * @brief setItemHash: true to keep a 64-bit hash(fasthash64) of every item added later.
+         *  it is saved in the record and checked when the item is read(views only if asked).
+         *  a mismatched item is reported and read as empty. default false.
+         */
+        void setItemHash(bool hash){
+            m_itemHash = hash;
+        }
+        /**
+         * @brief verifyAll: check the hash of every hashed item, in parallel by the thread count.
+         * @param badNames : optional, the names of the mismatched items.
+         * @return true if all match.
+         */
+        bool verifyAll(std::vector<String>* badNames = nullptr);
+
+        //the thread count used to compress/uncompress fragments in 'compressTo' and 'load'.
+        void setThreadCount(int count){
+            m_threadCount = count;
+        }
+        /**
+         * @brief setBlockSize: 'compressTo' splits every fragment into blocks of this raw size
+         *  and compresses them independently, so a lazy load only uncompresses the blocks an
+         *  item overlaps. 0 means one snappy stream per fragment. default 1M.
+         */
+        void setBlockSize(uint32 size){
+            m_blockSize = size;
+        }
+        //the byte budget of uncompressed blocks kept for lazy reads. default 256M.
+        //a one stream fragment(block size 0) is cached whole, charged at its raw size.
+        void setBlockCacheBudget(uint64 bytes){
+            m_blockCache.setBudget(bytes);
+        }
+        struct BlockCacheStats{
+            uint64 hits;
+            uint64 misses;
+            uint64 evictions;
+            uint64 used_size;
+        };
+        BlockCacheStats getBlockCacheStats(){
+            return {m_blockCache.getHitCount(), m_blockCache.getMissCount(),
+                    m_blockCache.getEvictionCount(), m_blockCache.getUsedSize()};
+        }
 
         void saveTo(const std::string& dir,const std::string& recordName,
                     const std::string& dataName);
@@ -57,32 +195,157 @@ using CString = const std::string&;
         void compressTo(const std::string& dir,const std::string& recordName,
                         const std::string& dataName);
 
+        /**
+         * @brief beginStream: start a streaming 'compressTo' on an empty manager. every
+         *  fragment is compressed and written as soon as it is full, then only kept
+         *  mapped. so the memory is about one fragment, whatever the total size is.
+         * @return false if the manager is not empty.
+         */
+        bool beginStream(const std::string& dir,const std::string& recordName,
+                         const std::string& dataName);
+        //write the last fragment and the record file of the stream.
+        void endStream();
+
+        /**
+         * @brief load: load the record file and the data files.
+         * @param lazy : true to mmap the data files and only page in (or decompress)
+         *  the fragments an item touches on its first read. default false.
+         */
         bool load(const std::string& dir,const std::string& recordName,
-                       const std::string& dataName);
+                       const std::string& dataName, bool lazy = false);
+
+        /**
+         * @brief packTo: write the items to one file: header, fragment table, page aligned
+         *  fragments, then the record. the fragments are compressed in parallel.
+         * @param compress : true to compress the fragments with the block size.
+         */
+        bool packTo(const std::string& file, bool compress = true);
+        /**
+         * @brief loadPack: load the file written by 'packTo'. it is mapped once and the
+         *  fragments are read at their offsets.
+         * @param lazy : true to keep the mapping and load the fragments on first read.
+         */
+        bool loadPack(const std::string& file, bool lazy = false);
 
         void reset(){
+            WriteGuard g(m_rwLock);
+            reset0();
+        }
+    private:
+        using ReadGuard = std::shared_lock<std::shared_mutex>;
+        using WriteGuard = std::unique_lock<std::shared_mutex>;
+
+        void reset0(){
             m_data.clear();
             m_items.clear();
+            m_index.clear();
+            m_shadowedCount = 0;
+            m_names.clear();
+            m_liveIds.clear();
+            m_sortedIds.clear();
+            m_removedCount = 0;
+            m_freeSize = 0;
+            m_streaming = false;
+            m_blockCache.clear();
         }
-    private:
-#define __CACHE_NAME_SIZE 124
+#define __CACHE_NAME_SIZE 124 //fixed name size of record version < 4.
+#define __CACHE_NAME_CHUNK (64 << 10)
+#define __CACHE_RECORD_MAGIC 0x52443748 //'H7DR', versioned record. older has no header.
+#define __CACHE_RECORD_VERSION 5
+#define __CACHE_READ_CHUNK_SIZE (8 << 20)
+#define __CACHE_BLOCK_BUDGET (256 << 20)
+#define __CACHE_WHOLE_BLOCK 0xffffffffu //block id of a one stream fragment in the block cache.
+#define __CACHE_INGEST_BUDGET (256 << 20)
+#define __CACHE_PAGE_SIZE 4096
+#define __CACHE_PACK_MAGIC 0x4B503748 //'H7PK'
+#define __CACHE_PACK_VERSION 1
+#define __CACHE_PACK_HEADER_SIZE 32
+#define __CACHE_PACK_ALIGN 4096
         struct Item{
-            char name[__CACHE_NAME_SIZE];
+            const char* name {nullptr}; //null terminated, in the name arena.
+            uint32 name_len {0};
             uint32 flags {0};
             std::vector<uint32> frag_ids;
             uint64 frag_offset; //the first frag offset.
             uint64 raw_size;
+            uint64 hash {0};    //valid if kFlag_HASHED.
+            bool removed {false};
+        };
+        struct Fragment{
+            std::shared_ptr<std::vector<char>> data; //raw data, valid when 'resident'. shared by views.
+            std::shared_ptr<MappedFile> file;  //mapped data file of lazy load.
+            uint64 size {0};                   //raw size
+            bool compressed {false};           //the mapped file is snappy compressed.
+            bool resident {true};
+            uint64 free_size {0};              //data size of removed items in it, or not used(shared by merge).
+            uint64 removed_size {0};           //data size of removed items in it.
+            uint32 block_size {0};             //raw size of a compressed block. 0 for one stream.
+            std::vector<uint64> block_ends;    //end offsets of the compressed blocks in file.
+            uint64 file_offset {0};            //the stored data of the fragment in 'file'.
+            uint64 file_size {0};
         };
+        //the names of items. the address of a name never changes until 'clear'.
+        struct NameArena{
+            std::vector<std::unique_ptr<char[]>> chunks;
+            char* cur {nullptr};
+            uint64 left {0};
+
+            const char* add(const char* str, uint64 len){
+                if(len + 1 > left){
+                    uint64 size = len + 1 > __CACHE_NAME_CHUNK ? len + 1 : __CACHE_NAME_CHUNK;
+                    chunks.emplace_back(new char[size]);
+                    cur = chunks.back().get();
+                    left = size;
+                }
+                char* ret = cur;
+                memcpy(ret, str, len);
+                ret[len] = '\0';
+                cur += len + 1;
+                left -= len + 1;
+                return ret;
+            }
+            //keep a whole block of names, like the string table of a record.
+            const char* adopt(std::unique_ptr<char[]> block){
+                chunks.push_back(std::move(block));
+                return chunks.back().get();
+            }
+            void clear(){
+                chunks.clear();
+                cur = nullptr;
+                left = 0;
+            }
+        };
+        using FragBlockTables = std::vector<std::vector<uint64>>;
         uint64 m_maxFragSize;
-        std::vector<std::vector<char>> m_data; //Fragmentation
+        int m_threadCount {1};
+        bool m_itemHash {false};
+        uint32 m_blockSize {1 << 20};
+        std::vector<Fragment> m_data; //Fragmentation
         std::vector<Item> m_items;
+        NameArena m_names;
+        std::unordered_map<std::string_view, uint32> m_index; //name -> item index. names are in 'm_names'.
+        uint32 m_shadowedCount {0}; //alive items whose name is indexed to an earlier item.
+        uint32 m_removedCount {0};
+        uint64 m_freeSize {0};
+        std::vector<uint32> m_liveIds;  //alive item indexes, built on need if any removed.
+        std::vector<uint32> m_sortedIds; //alive item indexes sorted by name, built on need.
+        bool m_streaming {false};
+        String m_streamDir;
+        String m_streamRecord;
+        String m_streamData;
+        //uncompressed blocks of lazy fragments. key: frag id << 32 | block id(or
+        //__CACHE_WHOLE_BLOCK for a one stream fragment).
+        LruCache<uint64, std::shared_ptr<std::vector<char>>, MutexLock> m_blockCache {__CACHE_BLOCK_BUDGET};
+        std::shared_mutex m_rwLock;
+        std::mutex m_lazyLock; //the lazy state which reads change.
 
         uint64 getLastFragUsedSize(){
-            return !m_data.empty() ? m_data[m_data.size()-1].size() :0;
+            return !m_data.empty() ? m_data[m_data.size()-1].size :0;
         }
         std::vector<char>& getLastBlock(uint64 newSize){
-            auto& block = m_data[m_data.size()-1];
+            auto& block = getResidentFrag(m_data.size()-1);
             block.resize(newSize);
+            m_data[m_data.size()-1].size = newSize;
             return block;
         }
         uint32 getLastBlockId(){
@@ -90,21 +353,104 @@ using CString = const std::string&;
         }
         std::vector<char>& newBlock(uint64 size){
             m_data.resize(m_data.size() + 1);
-            std::vector<char>& block = m_data[m_data.size()-1];
-            block.resize(size);
-            return block;
+            Fragment& frag = m_data[m_data.size()-1];
+            frag.data = std::make_shared<std::vector<char>>(size);
+            frag.size = size;
+            return *frag.data;
         }
+        //the mapped data of the lazy fragment.
+        inline const char* fileData(const Fragment& frag);
+        //raw data of the fragment, decompress it first if need.
+        const char* getFragData(uint32 id);
+        //the writable data of the fragment. copy it first if it is pinned by views.
+        std::vector<char>& getResidentFrag(uint32 id);
+        //the owner of the fragment data, for views.
+        std::shared_ptr<const void> getFragPin(uint32 id);
 
         int getItemByName(const std::string& name){
-            for(int i = 0 ; i < (int)m_items.size() ; i++){
-                if(name == m_items[i].name){
-                    return i;
+            auto it = m_index.find(name);
+            return it != m_index.end() ? (int)it->second : -1;
+        }
+        int getLiveItemIndex(uint32 index){
+            if(m_removedCount == 0){
+                return index;
+            }
+            std::lock_guard<std::mutex> g(m_lazyLock);
+            if(m_liveIds.empty()){
+                m_liveIds.reserve(m_items.size() - m_removedCount);
+                for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+                    if(!m_items[i].removed){
+                        m_liveIds.push_back(i);
+                    }
+                }
+            }
+            return m_liveIds[index];
+        }
+        const std::vector<uint32>& getSortedIds(){
+            std::lock_guard<std::mutex> g(m_lazyLock);
+            if(m_sortedIds.empty() && m_items.size() > m_removedCount){
+                m_sortedIds.reserve(m_items.size() - m_removedCount);
+                for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+                    if(!m_items[i].removed){
+                        m_sortedIds.push_back(i);
+                    }
                 }
+                std::sort(m_sortedIds.begin(), m_sortedIds.end(), [this](uint32 a, uint32 b){
+                    auto na = std::string_view(m_items[a].name, m_items[a].name_len);
+                    auto nb = std::string_view(m_items[b].name, m_items[b].name_len);
+                    return na != nb ? na < nb : a < b;
+                });
             }
-            return -1;
+            return m_sortedIds;
+        }
+        void rebuildIndex(){
+            m_index.clear();
+            m_index.reserve(m_items.size());
+            m_shadowedCount = 0;
+            for(uint32 i = 0 ; i < (uint32)m_items.size() ; i ++){
+                if(!m_items[i].removed && !m_index.emplace(std::string_view(
+                            m_items[i].name, m_items[i].name_len), i).second){
+                    m_shadowedCount ++;
+                }
+            }
+        }
+        void setItemName(Item& item, const std::string& name){
+            item.name = m_names.add(name.data(), name.length());
+            item.name_len = name.length();
         }
-        inline uint64 computeRecordSize();
-        inline void writeRecordFile(const std::string& file, bool compressed);
+        inline uint64 computeRecordSize(const FragBlockTables& tables, uint64 namesSize);
+        inline void writeRecordFile(const std::string& file, bool compressed,
+                                    uint32 blockSize, const FragBlockTables& tables);
+        inline void buildRecord(bool compressed, uint32 blockSize, const FragBlockTables& tables,
+                                std::vector<char>& out);
+        inline bool loadRecord(const char* buffer, uint64 size, bool& compressed);
+        inline void appendItemData(Item& item, const char* data, uint64 len);
+        inline void addItem0(Item&& item);
+        inline void writeCompressedFrag(uint32 id, const std::string& out_file, uint32 blockSize,
+                                        std::vector<uint64>& block_ends, int tc = 1);
+        inline void compressFrag(uint32 id, uint32 blockSize, std::string& out,
+                                 std::vector<uint64>& block_ends, int tc = 1);
+        inline void flushFragment(uint32 id);
         inline void getItemData0(int _idx, std::string& out);
+        inline bool checkItemHash(int _idx, const std::string& data);
+        //names from 'first' in name order, to 'last'(exclusive, empty for no bound)
+        //or while they start with 'first' if 'isPrefix'.
+        std::vector<String> listSorted0(const std::string& first, const std::string& last,
+                                        bool isPrefix);
+        inline bool checkItemHash(int _idx, const std::vector<DataSlice>& slices);
+        inline void getItemSlices(int _idx, std::vector<DataSlice>& out,
+                                  std::vector<std::shared_ptr<const void>>* pins);
+        inline void getFragSlices(uint32 id, uint64 start, uint64 len, std::vector<DataSlice>& out,
+                                  std::vector<std::shared_ptr<const void>>* pins);
+        inline std::shared_ptr<std::vector<char>> getFragBlock(uint32 id, uint32 b);
+        inline std::shared_ptr<std::vector<char>> getWholeFrag(uint32 id);
+        void compressTo0(const std::string& dir,const std::string& recordName,
+                         const std::string& dataName);
+        //'all': also drop the unused data of the fragments shared by 'merge'.
+        void compact0(bool all);
+        inline bool loadFragment(Fragment& frag);
+        //'compress'/'blockSize': the format which will be written.
+        inline void prepareOutFiles(const std::string& dataPrefix, bool compress,
+                                    uint32 blockSize);
     };
 }
@@ -23,10 +23,14 @@ public:
         bool exp = false;
         if(m_started.compare_exchange_strong(exp, true)){
             std::thread thd([this](){
-                while (!m_reqStop.load()) {
+                for (;;) {
+                    //read the flag first: tasks added before stop() are drained.
+                    const bool reqStop = m_reqStop.load();
                     T task;
                     if(m_queue->dequeue(task)){
                         m_func(task);
+                    }else if(reqStop){
+                        break;
                     }
                 }
                 m_lock.notify();
@@ -90,11 +94,14 @@ public:
         bool exp = false;
         if(m_started.compare_exchange_strong(exp, true)){
             std::thread thd([this](){
-                while (!m_reqStop.load()) {
+                for (;;) {
+                    const bool reqStop = m_reqStop.load();
                     SItem task;
                     if(m_queue->dequeue(task)){
                         auto r = m_func(task->t, task->p);
                         task->cb(r);
+                    }else if(reqStop){
+                        break;
                     }
                 }
                 m_lock.notify();
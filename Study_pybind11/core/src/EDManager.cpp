@@ -1,10 +1,12 @@
 #ifdef _MSC_VER
 #pragma warning(disable: 4786)
-#include <random>
 #endif
 
 #include <memory>
 #include <algorithm>
+#include <random>
+#include <unordered_set>
+#include <deque>
 #include "EDManager.h"
 #include "FileUtils.h"
 #include "string_utils.hpp"
@@ -15,18 +17,7 @@
 #include "helpers.h"
 #include "CmdBuilder2.h"
 #include "collections.h"
-
-#ifdef _MSC_VER
-namespace std {
-
-template <class _RanIt>
-static void random_shuffle(_RanIt _First, _RanIt _Last) {
-    std::random_device rd;
-    std::mt19937 g(rd());
-    std::shuffle(_First, _Last, g);
-}
-}
-#endif
+#include "ThreadPool.h"
 
 #ifndef DISABLE_ONNX2TRT
 #include "Med_ai_acc/med_infer_ctx.h"
@@ -38,19 +29,84 @@ static void random_shuffle(_RanIt _First, _RanIt _Last) {
 
 #define __INTERNAL_PREFIX "__$("
 #define __SALT_KEY __INTERNAL_PREFIX"SALT)"
+//'whiteout' item of the removed key, it hides the key in the layers below.
+#define __WHITEOUT_PREFIX __INTERNAL_PREFIX"WH)"
+//fragment size of the streaming compress, about the memory it holds.
+#define __STREAM_FRAG_SIZE (64 << 20)
+//salted items queued per thread in the salted export pipeline.
+#define __SALT_BATCH_PER_THREAD 4
 
 using namespace med_qa;
 namespace _h7 {
-struct MergeItem{
-    String name;
-    int idxMain {-1};
-    int idxSub {-1};
-};
-static inline int indexOf0(std::vector<String>& l, CString s){
-    for(int i = 0 ; i < (int)l.size() ; ++i){
-        if(l[i] == s) return i;
+//byte at 'pos' of the sliced data.
+static inline char byteAt(const h7::CacheManager::ItemView& v, h7::uint64 pos){
+    for(auto& sl : v.slices){
+        if(pos < sl.len){
+            return sl.data[pos];
+        }
+        pos -= sl.len;
+    }
+    MED_ASSERT(false);
+    return 0;
+}
+//salted data is reversed '1' + salt_len + salt + data (or '0' + data).
+//the header is read from the tail, then the data is reverse copied once.
+static inline void decodeSalted(const h7::CacheManager::ItemView& v, String& out){
+    out.clear();
+    const h7::uint64 size = v.size;
+    if(size == 0){
+        return;
+    }
+    h7::uint64 head = 1;
+    if(byteAt(v, size - 1) == '1'){
+        MED_ASSERT(size >= 1 + sizeof(size_t));
+        char lenBuf[sizeof(size_t)];
+        for(int k = 0 ; k < (int)sizeof(size_t) ; ++k){
+            lenBuf[k] = byteAt(v, size - 2 - k);
+        }
+        size_t saltLen = 0;
+        memcpy(&saltLen, lenBuf, sizeof(size_t));
+        MED_ASSERT(saltLen <= size - 1 - sizeof(size_t));
+        head = 1 + sizeof(size_t) + saltLen;
+    }
+    const h7::uint64 len = size - head;
+    out.resize(len);
+    h7::uint64 pos = 0;
+    for(auto& sl : v.slices){
+        if(pos >= len){
+            break;
+        }
+        auto n = HMIN(sl.len, len - pos);
+        std::reverse_copy(sl.data, sl.data + n, &out[len - pos - n]);
+        pos += n;
     }
-    return -1;
+}
+//read the item of the layer which has it.
+static inline bool readItem(h7::CacheManager* cm, bool salted, CString key, String& out){
+    if(!salted || key.find(__INTERNAL_PREFIX) != String::npos){
+        cm->getItemData(key, out);
+        return true;
+    }
+    h7::CacheManager::ItemView view;
+    if(!cm->getItemView(key, view, true)){
+        return false;
+    }
+    decodeSalted(view, out);
+    return true;
+}
+//reversed '1' + salt_len + shuffled salt + data, written back to front in one pass.
+static inline void encodeSalted(CString data, CString salt, String& out){
+    thread_local std::mt19937 rng(std::random_device{}());
+    const size_t saltLen = salt.length();
+    out.resize(1 + sizeof(size_t) + saltLen + data.length());
+    char* p = &out[0];
+    p = std::reverse_copy(data.begin(), data.end(), p);
+    String saltStr = salt;
+    std::shuffle(saltStr.begin(), saltStr.end(), rng);
+    p = std::reverse_copy(saltStr.begin(), saltStr.end(), p);
+    const char* lenBuf = (const char*)&saltLen;
+    p = std::reverse_copy(lenBuf, lenBuf + sizeof(size_t), p);
+    *p = '1';
 }
 }
 template<typename T>
@@ -80,10 +136,22 @@ static inline String formatDimsImpl(const std::vector<T>& vec,
 //}
 
 EDManager::~EDManager(){
+    //wait for the pending prefetches.
+    if(m_prefetchPool){
+        delete m_prefetchPool;
+        m_prefetchPool = nullptr;
+    }
     if(m_cacheM){
         delete m_cacheM;
         m_cacheM = nullptr;
     }
+    clearLayers();
+}
+void EDManager::clearLayers(){
+    for(auto& layer : m_layers){
+        delete layer.cm;
+    }
+    m_layers.clear();
 }
 void EDManager::compress(bool verify){
     MED_ASSERT(!m_encFileDirs.empty());
@@ -137,13 +205,15 @@ void EDManager::compress(CList<String> files, CList<String> keys,bool verify){
     //dir,recordName,dataName
     //
     {
-        CacheManager cm(2 << 30); //max 2G
-        int size = files.size();
-        for(int i = 0 ; i < size ; ++i){
-            cm.addFileItem(m_keys[i], files[i]);
-        }
+        //full fragments are written while adding.
+        CacheManager cm(__STREAM_FRAG_SIZE);
+        cm.setThreadCount(m_threadCount);
+        cm.setItemHash(true);
+        MED_ASSERT(cm.beginStream(desc[0], desc[1], desc[2]));
+        //files are read and hashed on the pool, added in order.
+        cm.addFileItems(m_keys, files);
         //key id item.
-        cm.compressTo(desc[0], desc[1], desc[2]);
+        cm.endStream();
         ph.print("compress");
     }
 #ifdef WITH_ONNX_PARSER
@@ -178,16 +248,15 @@ void EDManager::compress(CList<String> files, CList<String> keys,bool verify){
     if(verify){
         ph.begin();
         CacheManager cm(2 << 30);
-        cm.load(desc[0], desc[1], desc[2]);
-        int size = files.size();
-        for(int i = 0 ; i < size ; ++i){
-            String rawContent = FileUtils::getFileContent(files[i]);
-            String out;
-            cm.getItemData(m_keys[i], out);
-            //fasthash64();
-            if(rawContent != out){
-                fprintf(stderr, " verify >> enc-dec failed, key = '%s'\n", m_keys[i].data());
-            }
+        cm.setThreadCount(m_threadCount);
+        cm.load(desc[0], desc[1], desc[2], true);
+        //the item hashes are of the source files, no need to read them again.
+        if((int)cm.getItemCount() != (int)files.size()){
+            fprintf(stderr, " verify >> item count = %u, file count = %d\n",
+                    cm.getItemCount(), (int)files.size());
+        }
+        if(!cm.verifyAll()){
+            fprintf(stderr, " verify >> enc-dec failed.\n");
         }
         ph.print("verify");
     }
@@ -196,95 +265,302 @@ void EDManager::loadDir(CString dir){
     String desc = dir + ",record,data";
     load(desc);
 }
-void EDManager::load(CString _encOutDesc){
+void EDManager::load(CString encOutDesc){
+    h7::PerformanceHelper ph;
+    ph.begin();
+    bool salted;
+    auto cm = loadStore(encOutDesc, salted);
+    std::unique_lock<std::shared_mutex> g(m_lock);
+    if(m_cacheM){
+        delete m_cacheM;
+    }
+    clearLayers();
+    m_cacheM = cm;
+    m_salted = salted;
+    ph.print("loadED");
+}
+h7::CacheManager* EDManager::loadStore(CString _encOutDesc, bool& salted){
     String encOutDesc = _encOutDesc;
     if(encOutDesc.find(",") == String::npos){
         encOutDesc = encOutDesc + ",record,data";
     }
-    h7::PerformanceHelper ph;
-    ph.begin();
     auto desc = h7::utils::split(",", encOutDesc);
     MED_ASSERT_X(desc.size() == 3, encOutDesc);
     //
     MED_ASSERT_X(h7::FileUtils::isFileExists(desc[0]), desc[0]);
     //
     using namespace h7;
-    if(m_cacheM){
-        delete m_cacheM;
-        m_cacheM = nullptr;
+    auto cm = new CacheManager(2 << 30);
+    cm->setThreadCount(m_threadCount);
+    if(m_blockCacheBudget >= 0){
+        cm->setBlockCacheBudget(m_blockCacheBudget);
     }
-    m_cacheM = new CacheManager(2 << 30);
-    m_cacheM->load(desc[0], desc[1], desc[2]);
-    //check salt
+    cm->load(desc[0], desc[1], desc[2], m_lazyLoad);
+    //check salt. salted items are decoded on read.
     String salt;
-    m_cacheM->getItemData(__SALT_KEY, salt);
-    if(!salt.empty()){
-        auto newCM = std::unique_ptr<CacheManager>(new h7::CacheManager(2 << 30));
-        int c = m_cacheM->getItemCount();
-        for(int i = 0 ; i < c ; ++i){
-        //for(int i :MFOREACH(c)){
-            String name;
-            String data;
-            m_cacheM->getItemAt(i, name, data);
-            if(name != __SALT_KEY){
-                if(name.find(__INTERNAL_PREFIX) != String::npos){
-                    newCM->addItem(name, data);
-                    continue;
-                }
-                std::reverse(data.begin(), data.end());
-                int offset = 0;
-                if(data.data()[0] == '1'){
-                    size_t saltLen = 0;
-                    memcpy(&saltLen, data.data() + 1, sizeof(size_t));
-                    offset = 1 + sizeof(size_t) + saltLen;
-                }else{
-                    offset = 1;
-                }
-                newCM->addItem(name, String(data.data() + offset, data.length() - offset));
-            }
+    cm->getItemData(__SALT_KEY, salt);
+    salted = !salt.empty();
+    return cm;
+}
+void EDManager::addLayer(CString encOutDesc){
+    h7::PerformanceHelper ph;
+    ph.begin();
+    bool salted = false;
+    h7::CacheManager* cm;
+    if(encOutDesc.empty()){
+        cm = new h7::CacheManager(2 << 30);
+        cm->setThreadCount(m_threadCount);
+    }else{
+        cm = loadStore(encOutDesc, salted);
+    }
+    std::unique_lock<std::shared_mutex> g(m_lock);
+    if(m_cacheM){
+        Layer layer;
+        layer.cm = m_cacheM;
+        layer.salted = m_salted;
+        m_layers.push_back(std::move(layer));
+    }
+    m_cacheM = cm;
+    m_salted = salted;
+    ph.print("addLayer::" + encOutDesc);
+}
+int EDManager::getLayerCount(){
+    std::shared_lock<std::shared_mutex> g(m_lock);
+    return m_cacheM ? m_layers.size() + 1 : 0;
+}
+h7::CacheManager* EDManager::findItem0(CString key, bool& salted){
+    if(!m_cacheM || key == __SALT_KEY || key.find(__WHITEOUT_PREFIX) == 0){
+        return nullptr;
+    }
+    salted = m_salted;
+    if(m_cacheM->hasItem(key)){
+        return m_cacheM;
+    }
+    if(m_layers.empty()){
+        return nullptr;
+    }
+    //the nearest layer has it or hides it.
+    String wh = __WHITEOUT_PREFIX + key;
+    if(m_cacheM->hasItem(wh)){
+        return nullptr;
+    }
+    for(int i = (int)m_layers.size() - 1 ; i >= 0 ; --i){
+        auto& layer = m_layers[i];
+        if(layer.cm->hasItem(key)){
+            salted = layer.salted;
+            return layer.cm;
+        }
+        if(layer.cm->hasItem(wh)){
+            return nullptr;
         }
-        delete m_cacheM;
-        m_cacheM = newCM.release();
     }
-    ph.print("loadED");
+    return nullptr;
 }
-String EDManager::getItem(CString key){
+bool EDManager::getItem0(CString key, String& out){
+    out.clear();
+    bool salted;
+    auto cm = findItem0(key, salted);
+    return cm != nullptr && _h7::readItem(cm, salted, key, out);
+}
+bool EDManager::getItemRef0(CString key, ItemRef& out){
+    out = ItemRef();
+    bool salted;
+    auto cm = findItem0(key, salted);
+    if(cm == nullptr){
+        return false;
+    }
+    if(salted && key.find(__INTERNAL_PREFIX) == String::npos){
+        //decoded once, the ref owns it.
+        auto data = std::make_shared<String>();
+        if(!_h7::readItem(cm, salted, key, *data)){
+            return false;
+        }
+        out.slices.emplace_back(data->data(), data->length());
+        out.size = data->length();
+        out.pin = std::move(data);
+        return true;
+    }
+    //checked like 'getItemData', a mismatched item is not found.
+    h7::CacheManager::ItemView view;
+    if(!cm->getItemView(key, view, true)){
+        return false;
+    }
+    out.slices.reserve(view.slices.size());
+    for(auto& sl : view.slices){
+        out.slices.emplace_back(sl.data, sl.len);
+    }
+    out.size = view.size;
+    out.pin = std::move(view.pin);
+    return true;
+}
+bool EDManager::getItemRef(CString key, ItemRef& out){
+    std::shared_lock<std::shared_mutex> g(m_lock);
+    return getItemRef0(key, out);
+}
+int EDManager::getItemRefs(CList<String> keys, List<ItemRef>& out){
+    std::shared_lock<std::shared_mutex> g(m_lock);
+    out.resize(keys.size());
+    int found = 0;
+    for(size_t i = 0 ; i < keys.size() ; ++i){
+        if(getItemRef0(keys[i], out[i])){
+            found ++;
+        }
+    }
+    return found;
+}
+List<String> EDManager::getItemNames0(const String* prefix){
+    List<String> ret;
     if(!m_cacheM){
-        return "";
+        return ret;
+    }
+    std::unordered_set<String> seen;
+    std::unordered_set<String> hidden;
+    const size_t whLen = strlen(__WHITEOUT_PREFIX);
+    auto visit = [&](h7::CacheManager* cm){
+        List<String> names;
+        if(prefix){
+            names = cm->listPrefix(*prefix);
+            if(!m_layers.empty()){
+                auto whs = cm->listPrefix(__WHITEOUT_PREFIX + *prefix);
+                names.insert(names.end(), whs.begin(), whs.end());
+            }
+        }else{
+            names = cm->getItemNames();
+        }
+        for(auto& name : names){
+            if(name == __SALT_KEY || name.find(__WHITEOUT_PREFIX) == 0){
+                continue;
+            }
+            if(hidden.find(name) == hidden.end() && seen.insert(name).second){
+                ret.push_back(name);
+            }
+        }
+        //whiteouts only hide the layers below.
+        for(auto& name : names){
+            if(name.find(__WHITEOUT_PREFIX) == 0){
+                hidden.insert(name.substr(whLen));
+            }
+        }
+    };
+    visit(m_cacheM);
+    for(int i = (int)m_layers.size() - 1 ; i >= 0 ; --i){
+        visit(m_layers[i].cm);
+    }
+    if(prefix && !m_layers.empty()){
+        std::sort(ret.begin(), ret.end());
+    }
+    return ret;
+}
+List<String> EDManager::listPrefix(CString prefix){
+    std::shared_lock<std::shared_mutex> g(m_lock);
+    return getItemNames0(&prefix);
+}
+void EDManager::addItem0(CString key, CString data){
+    if(!m_salted || key.find(__INTERNAL_PREFIX) != String::npos){
+        m_cacheM->addItem(key, data);
+        return;
+    }
+    //reversed '0' + data.
+    String cs(data.rbegin(), data.rend());
+    cs.push_back('0');
+    m_cacheM->addItem(key, cs);
+}
+void EDManager::removeItem0(CString key){
+    m_cacheM->removeItem(key);
+    if(!m_layers.empty()){
+        String wh = __WHITEOUT_PREFIX + key;
+        if(!m_cacheM->hasItem(wh)){
+            m_cacheM->addItem(wh, "");
+        }
+    }
+}
+std::shared_future<int> EDManager::prefetch(CList<String> keys,
+                                            std::function<void(int)> callback){
+    {
+        std::lock_guard<std::mutex> lg(m_prefetchLock);
+        if(m_prefetchPool == nullptr){
+            m_prefetchPool = new h7::ThreadPool(1);
+        }
     }
+    return m_prefetchPool->enqueue([this, keys, callback](){
+        int found = 0;
+        {
+            std::shared_lock<std::shared_mutex> g(m_lock);
+            //the keys of every layer are warmed together.
+            std::map<h7::CacheManager*, List<String>> groups;
+            for(auto& key : keys){
+                bool salted;
+                auto cm = findItem0(key, salted);
+                if(cm){
+                    groups[cm].push_back(key);
+                }
+            }
+            for(auto& it : groups){
+                found += it.first->prefetch(it.second);
+            }
+        }
+        if(callback){
+            callback(found);
+        }
+        return found;
+    }).share();
+}
+String EDManager::getItem(CString key){
+    std::shared_lock<std::shared_mutex> g(m_lock);
     String out;
-    m_cacheM->getItemData(key, out);
+    getItem0(key, out);
     return out;
 }
 void EDManager::addItem(CString key, CString data){
+    std::unique_lock<std::shared_mutex> g(m_lock);
     if(!m_cacheM){
         m_cacheM = new h7::CacheManager(2 << 30);
+        m_cacheM->setThreadCount(m_threadCount);
+        m_salted = false;
     }
     m_cacheM->removeItem(key);
-    m_cacheM->addItem(key, data);
+    if(!m_layers.empty()){
+        m_cacheM->removeItem(__WHITEOUT_PREFIX + key);
+    }
+    addItem0(key, data);
 }
 void EDManager::removeItem(CString key){
+    std::unique_lock<std::shared_mutex> g(m_lock);
     if(m_cacheM){
-        m_cacheM->removeItem(key);
+        removeItem0(key);
     }
 }
 void EDManager::removeItemIfExclude(CList<String> keys){
+    std::unique_lock<std::shared_mutex> g(m_lock);
     if(!m_cacheM){
         return;
     }
-    int count = m_cacheM->getItemCount();
-    for(int i = count - 1 ; i >= 0 ; --i){
-        String key, data;
-        m_cacheM->getItemAt(i, key, data);
+    auto names = getItemNames0();
+    for(int i = (int)names.size() - 1 ; i >= 0 ; --i){
+        auto& key = names[i];
         if(!med_qa::contains(keys, key)){
-            m_cacheM->removeItem(key);
+            removeItem0(key);
         }else{
             printf("retain key: %s\n", key.data());
         }
     }
+    //the removed data is freed once.
+    m_cacheM->compact();
 }
 EDManager* EDManager::merge(EDManager& oth){
-    using namespace _h7;
+    if(&oth == this){
+        return this;
+    }
+    std::unique_lock<std::shared_mutex> g(m_lock, std::defer_lock);
+    std::shared_lock<std::shared_mutex> g_oth(oth.m_lock, std::defer_lock);
+    //locked in address order, so 'a.merge(b)' and 'b.merge(a)' don't deadlock.
+    if(std::less<std::shared_mutex*>()(&m_lock, &oth.m_lock)){
+        g.lock();
+        g_oth.lock();
+    }else{
+        g_oth.lock();
+        g.lock();
+    }
     if(m_cacheM == nullptr){
         fprintf(stderr, "EDManager::merge >> main is empty, no need.\n");
         return &oth;
@@ -293,42 +569,23 @@ EDManager* EDManager::merge(EDManager& oth){
         fprintf(stderr, "EDManager::merge >> oth is empty, no need.\n");
         return this;
     }
-    auto names_main = m_cacheM->getItemNames();
-    auto names_sub = oth.m_cacheM->getItemNames();
-    //
-    std::map<String, MergeItem> itemMap;
-    //replace same item. from sub to main.
-    for(int i = 0 ; i < (int)names_main.size() ; ++i){
-        auto& s = names_main[i];
-        MergeItem mi;
-        mi.name = s;
-        mi.idxMain = i;
-        mi.idxSub = _h7::indexOf0(names_sub, s);
-        itemMap.emplace(s, std::move(mi));
-    }
-    //add not exist item, from sub to main
-    for(int i = 0 ; i < (int)names_sub.size() ; ++i){
-        auto& s = names_sub[i];
-        //not exist.
-        if(itemMap.find(s) == itemMap.end()){
-            MergeItem mi;
-            mi.name = s;
-            mi.idxMain = -1;
-            mi.idxSub = i;
-            itemMap.emplace(s, std::move(mi));
-        }
-    }
-    auto it = itemMap.begin();
-    while (it != itemMap.end()) {
-        auto& item = it->second;
-        if(item.idxMain >= 0){
-            m_cacheM->removeItem(item.name);
+    if(m_salted == oth.m_salted && m_layers.empty() && oth.m_layers.empty()){
+        //same encoding, the items of oth are taken with their fragments.
+        m_cacheM->merge(*oth.m_cacheM);
+        return this;
+    }
+    //add not exist item, from sub to main. decoded and encoded again.
+    auto names_main = getItemNames0();
+    std::unordered_set<String> mainSet(names_main.begin(), names_main.end());
+    auto names_sub = oth.getItemNames0();
+    for(auto& name : names_sub){
+        if(mainSet.find(name) != mainSet.end()){
+            continue;
         }
         String data;
-        oth.m_cacheM->getItemData(item.name, data);
-        m_cacheM->addItem(item.name, data);
-        //
-        ++it;
+        if(oth.getItem0(name, data)){
+            addItem0(name, data);
+        }
     }
     return this;
 }
@@ -340,51 +597,106 @@ EDManager* EDManager::mergeByPriority(EDManager& oth, bool curIsHigh){
     }
 }
 void EDManager::compressTo(CString encOutDesc){
+    std::unique_lock<std::shared_mutex> g(m_lock);
     MED_ASSERT(m_cacheM);
     using namespace h7;
     auto desc = h7::utils::split(",", encOutDesc);
     MED_ASSERT(desc.size() == 3);
     h7::PerformanceHelper ph;
     ph.begin();
-    m_cacheM->compressTo(desc[0], desc[1], desc[2]);
+    m_cacheM->setThreadCount(m_threadCount);
+    if(m_salted || !m_layers.empty()){
+        //the output is not salted, and the layers are resolved.
+        CacheManager cm(2 << 30);
+        cm.setThreadCount(m_threadCount);
+        auto names = getItemNames0();
+        for(auto& name : names){
+            String data;
+            if(getItem0(name, data)){
+                cm.addItem(name, data);
+            }
+        }
+        cm.compressTo(desc[0], desc[1], desc[2]);
+    }else{
+        m_cacheM->compressTo(desc[0], desc[1], desc[2]);
+    }
     ph.print("compressTo::" + encOutDesc);
 }
+void EDManager::compressLayerTo(CString encOutDesc){
+    std::unique_lock<std::shared_mutex> g(m_lock);
+    MED_ASSERT(m_cacheM);
+    auto desc = h7::utils::split(",", encOutDesc);
+    MED_ASSERT(desc.size() == 3);
+    h7::PerformanceHelper ph;
+    ph.begin();
+    m_cacheM->setThreadCount(m_threadCount);
+    m_cacheM->compressTo(desc[0], desc[1], desc[2]);
+    ph.print("compressLayerTo::" + encOutDesc);
+}
 void EDManager::compressTo(CString encOutDesc, CString salt){
     if(salt.empty()){
         compressTo(encOutDesc);
         return;
     }
     using namespace h7;
+    std::unique_lock<std::shared_mutex> g(m_lock);
     h7::PerformanceHelper ph;
     ph.begin();
     MED_ASSERT(m_cacheM);
-    auto newCM = std::unique_ptr<CacheManager>(new h7::CacheManager(2 << 30));
-    int c = m_cacheM->getItemCount();
-    for(int i = 0 ; i < c ; ++i){
-    //for(int i :MFOREACH(c)){
-        String name;
-        String data;
-        m_cacheM->getItemAt(i, name, data);
-        //internal, no need enc
-        if(name.find(__INTERNAL_PREFIX) != String::npos){
-            newCM->addItem(name, data);
-            continue;
-        }
-        //
-        size_t len = data.length();
-        char lenStr[sizeof(size_t)];
-        memcpy(lenStr, &len, sizeof(size_t));
-        String saltStr = salt;
-        std::random_shuffle(saltStr.begin(), saltStr.end());
-        auto cs = "1" + String(lenStr) + saltStr + data;
-        std::reverse(cs.begin(), cs.end());
-        newCM->addItem(name, cs);
-    }
-    newCM->addItem(__SALT_KEY, salt);
-    //
     auto desc = h7::utils::split(",", encOutDesc);
     MED_ASSERT(desc.size() == 3);
-    newCM->compressTo(desc[0], desc[1], desc[2]);
+    //full fragments are written while adding.
+    CacheManager cm(__STREAM_FRAG_SIZE);
+    cm.setThreadCount(m_threadCount);
+    MED_ASSERT(cm.beginStream(desc[0], desc[1], desc[2]));
+    auto names = getItemNames0();
+    //old salt replaced, internal items are not salted.
+    using SaltedItem = std::pair<bool, String>;
+    auto saltItem = [this, &salt](const String& name){
+        SaltedItem ret;
+        String data;
+        ret.first = getItem0(name, data);
+        if(ret.first){
+            if(name.find(__INTERNAL_PREFIX) != String::npos){
+                ret.second = std::move(data);
+            }else{
+                _h7::encodeSalted(data, salt, ret.second);
+            }
+        }
+        return ret;
+    };
+    const int tc = HMAX(m_threadCount, 1);
+    if(tc <= 1){
+        for(auto& name : names){
+            auto item = saltItem(name);
+            if(item.first){
+                cm.addItem(name, item.second);
+            }
+        }
+    }else{
+        //pipeline: the pool salts ahead while this thread adds the items in order,
+        //which compresses and writes the full fragments. at most 'window' salted
+        //items wait in the queue.
+        const size_t window = tc * __SALT_BATCH_PER_THREAD;
+        ThreadPool pool(tc);
+        std::deque<std::future<SaltedItem>> queue;
+        size_t next = 0;
+        for(size_t i = 0 ; i < names.size() ; ++i){
+            for(; next < names.size() && queue.size() < window ; ++next){
+                auto& name = names[next];
+                queue.push_back(pool.enqueue([&saltItem, &name](){
+                    return saltItem(name);
+                }));
+            }
+            auto item = queue.front().get();
+            queue.pop_front();
+            if(item.first){
+                cm.addItem(names[i], item.second);
+            }
+        }
+    }
+    cm.addItem(__SALT_KEY, salt);
+    cm.endStream();
     ph.print("compressTo::" + encOutDesc);
 }
 //-------------
@@ -429,14 +741,15 @@ String EDManager::getKPID(){
 #endif
 }
 void EDManager::prints(int limitLen){
+    std::shared_lock<std::shared_mutex> g(m_lock);
     if(m_cacheM){
-        int c = m_cacheM->getItemCount();
-        printf("[EDM] prints: limit = %d, count = %d\n", limitLen, c);
-        for(int i = 0 ; i < c; ++i){
-        //for(int i :MFOREACH(c)){
-            String name;
+        auto names = getItemNames0();
+        printf("[EDM] prints: limit = %d, count = %d\n", limitLen, (int)names.size());
+        for(auto& name : names){
             String data;
-            m_cacheM->getItemAt(i, name, data);
+            if(!getItem0(name, data)){
+                continue;
+            }
             if((int)data.length() > limitLen){
                 auto hash = fasthash64(data.data(), data.length(), 11);
                 printf("kv(over_limit) = %s, hash = %lu\n", name.data(), hash);
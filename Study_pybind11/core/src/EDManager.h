@@ -3,9 +3,15 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <shared_mutex>
 
 namespace h7 {
     class CacheManager;
+    class ThreadPool;
 }
 
 namespace med_qa {
@@ -35,6 +41,12 @@ public:
     void setIgnorePath(CString paths);
     //, for multi
     void setIncludePath(CString paths);
+    //true to mmap the data files on load, and decompress fragments on first use.
+    void setLazyLoad(bool lazy){m_lazyLoad = lazy;}
+    //thread count to compress/uncompress the data fragments.
+    void setThreadCount(int count){m_threadCount = count;}
+    //byte budget of the uncompressed blocks kept by lazy load. see 'CacheManager::setBlockCacheBudget'.
+    void setBlockCacheBudget(long long bytes){m_blockCacheBudget = bytes;}
     List<String>& getKeys(){return m_keys;}
     List<String>& getInputShapeStrs(){return m_inputShapes;}
     List<String>& getInputNames(){return m_inputNames;}
@@ -44,7 +56,39 @@ public:
 
     void load(CString encOutDesc);
     void loadDir(CString dir);
+    /**
+     * @brief addLayer: mount a loaded archive on top of the current items, without merging.
+     *  'getItem' finds the item in the top layer first, and the whiteouts of a layer
+     *  (removed items) hide the items below it. later edits go to the top layer.
+     * @param encOutDesc : the archive, like 'load'. empty for a new empty layer, whose
+     *  edits can be written as a patch by 'compressLayerTo'.
+     */
+    void addLayer(CString encOutDesc);
+    //layer count, include the bottom one.
+    int getLayerCount();
+    //the item data without copy. 'pin' keeps the slices valid, even after the item is
+    //removed or the manager is destroyed. a salted item is decoded once into it.
+    struct ItemRef{
+        List<std::pair<const char*, size_t>> slices; //in order, one if contiguous.
+        std::shared_ptr<const void> pin;
+        size_t size {0};
+    };
+    //can be called from many threads at the same time. the others are exclusive.
     String getItem(CString key);
+    //false if the item doesn't exist, or its hash(if kept) mismatches.
+    bool getItemRef(CString key, ItemRef& out);
+    //keys start with 'prefix' of all layers, in name order. see 'CacheManager::listPrefix'.
+    List<String> listPrefix(CString prefix);
+    //refs of many keys under one lock. the ref of a missing key has no pin. return the found count.
+    int getItemRefs(CList<String> keys, List<ItemRef>& out);
+    /**
+     * @brief prefetch: warm the data of the items on a background thread, so the later
+     *  reads of them don't wait for loading and decompression.
+     * @param callback : called with the count of found items on that thread, if set.
+     * @return the future of the found count.
+     */
+    std::shared_future<int> prefetch(CList<String> keys,
+                                     std::function<void(int)> callback = nullptr);
     void addItem(CString key, CString data);
     void removeItem(CString key);
     void removeItemIfExclude(CList<String> keys);
@@ -53,8 +97,10 @@ public:
     EDManager* merge(EDManager& oth);
 
     EDManager* mergeByPriority(EDManager& oth, bool curIsHigh);
-    //often used after merge.
+    //often used after merge. layers are written as one archive.
     void compressTo(CString encOutDesc);
+    //only write the top layer with its whiteouts, as a patch for 'addLayer'.
+    void compressLayerTo(CString encOutDesc);
 
     void compressTo(CString encOutDesc, CString salt);
 public:
@@ -65,6 +111,19 @@ public:
 private:
     bool shouldIgnore(CString path);
     bool shouldInclude(CString path);
+    h7::CacheManager* loadStore(CString encOutDesc, bool& salted);
+    //the layer which has the item, null if it is missing or hidden. caller holds the lock.
+    h7::CacheManager* findItem0(CString key, bool& salted);
+    bool getItemRef0(CString key, ItemRef& out);
+    //alive names of all layers, top first. caller holds the lock.
+    List<String> getItemNames0(const String* prefix = nullptr);
+    //remove from the top layer, and hide the items below. caller holds the exclusive lock.
+    void removeItem0(CString key);
+    void clearLayers();
+    //item data, salted items are decoded. caller holds the lock.
+    bool getItem0(CString key, String& out);
+    //salted store keeps added items encoded. caller holds the exclusive lock.
+    void addItem0(CString key, CString data);
 
 private:
     List<String> m_keys;
@@ -75,7 +134,19 @@ private:
     String m_encOutDesc;
     List<String> m_ignorePath;//dirs or files
     List<String> m_incPaths;
-    h7::CacheManager* m_cacheM {nullptr};
+    struct Layer{
+        h7::CacheManager* cm {nullptr};
+        bool salted {false};
+    };
+    h7::CacheManager* m_cacheM {nullptr}; //top layer, the edits go to it.
+    List<Layer> m_layers;                 //read-only layers below, from bottom to top.
+    bool m_lazyLoad {false};
+    int m_threadCount {1};
+    long long m_blockCacheBudget {-1}; //-1 for default.
+    bool m_salted {false}; //items are salted, decoded on read.
+    std::shared_mutex m_lock; //guard m_cacheM.
+    h7::ThreadPool* m_prefetchPool {nullptr}; //created on the first prefetch.
+    std::mutex m_prefetchLock;
 };
 
 }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "locks.h"
+
+namespace h7 {
+
+//least recently used cache, bounded by the total size of the values.
+template<typename K, typename V, class Lock = NullLock>
+class LruCache{
+    typedef Lock Lock_type;
+    using Guard = std::lock_guard<Lock_type>;
+    struct Entry{
+        K key;
+        V value;
+        size_t size;
+    };
+    using EntryList = std::list<Entry>;
+public:
+    LruCache(size_t budget):m_budget(budget){}
+
+    //evict old values until the used size fits the budget.
+    void setBudget(size_t budget){
+        Guard g(m_lock);
+        m_budget = budget;
+        evict0(0);
+    }
+    bool get(const K& k, V& out){
+        Guard g(m_lock);
+        auto it = m_map.find(k);
+        if(it == m_map.end()){
+            m_misses ++;
+            return false;
+        }
+        m_hits ++;
+        m_list.splice(m_list.begin(), m_list, it->second);
+        out = it->second->value;
+        return true;
+    }
+    //value bigger than the budget is not kept.
+    void put(const K& k, const V& v, size_t size){
+        Guard g(m_lock);
+        auto it = m_map.find(k);
+        if(it != m_map.end()){
+            m_used -= it->second->size;
+            m_list.erase(it->second);
+            m_map.erase(it);
+        }
+        if(size > m_budget){
+            return;
+        }
+        evict0(size);
+        m_list.push_front({k, v, size});
+        m_map[k] = m_list.begin();
+        m_used += size;
+    }
+    void clear(){
+        Guard g(m_lock);
+        m_list.clear();
+        m_map.clear();
+        m_used = 0;
+    }
+    size_t getBudget(){Guard g(m_lock); return m_budget;}
+    size_t getUsedSize(){Guard g(m_lock); return m_used;}
+    size_t getHitCount(){Guard g(m_lock); return m_hits;}
+    size_t getMissCount(){Guard g(m_lock); return m_misses;}
+    size_t getEvictionCount(){Guard g(m_lock); return m_evictions;}
+
+private:
+    void evict0(size_t need){
+        while (!m_list.empty() && m_used + need > m_budget) {
+            auto& e = m_list.back();
+            m_used -= e.size;
+            m_map.erase(e.key);
+            m_list.pop_back();
+            m_evictions ++;
+        }
+    }
+
+private:
+    size_t m_budget;
+    size_t m_used {0};
+    size_t m_hits {0};
+    size_t m_misses {0};
+    size_t m_evictions {0};
+    EntryList m_list; //front is the most recently used.
+    std::unordered_map<K, typename EntryList::iterator> m_map;
+    mutable Lock m_lock;
+};
+}
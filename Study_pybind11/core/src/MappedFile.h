@@ -0,0 +1,121 @@
+#pragma once
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#undef NOMINMAX
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+
+namespace h7 {
+
+    //read-only memory mapping of a whole file.
+    class MappedFile{
+    public:
+        MappedFile(){}
+        MappedFile(const std::string& path){
+            open(path);
+        }
+        ~MappedFile(){
+            close();
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& path){
+            close();
+            m_path = path;
+#ifdef _WIN32
+            m_file = CreateFileA(path.data(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if(m_file == INVALID_HANDLE_VALUE){
+                return false;
+            }
+            LARGE_INTEGER li;
+            if(!GetFileSizeEx(m_file, &li) || li.QuadPart == 0){
+                close();
+                return false;
+            }
+            m_size = (size_t)li.QuadPart;
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if(m_mapping == NULL){
+                close();
+                return false;
+            }
+            m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+            if(m_data == nullptr){
+                close();
+                return false;
+            }
+#else
+            int fd = ::open(path.data(), O_RDONLY);
+            if(fd < 0){
+                return false;
+            }
+            struct stat st;
+            if(fstat(fd, &st) != 0 || st.st_size == 0){
+                ::close(fd);
+                return false;
+            }
+            m_size = (size_t)st.st_size;
+            void* ptr = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            //the mapping keeps its own reference to the file.
+            ::close(fd);
+            if(ptr == MAP_FAILED){
+                m_size = 0;
+                return false;
+            }
+            m_data = (const char*)ptr;
+#endif
+            return true;
+        }
+        void close(){
+#ifdef _WIN32
+            if(m_data){
+                UnmapViewOfFile(m_data);
+            }
+            if(m_mapping != NULL){
+                CloseHandle(m_mapping);
+                m_mapping = NULL;
+            }
+            if(m_file != INVALID_HANDLE_VALUE){
+                CloseHandle(m_file);
+                m_file = INVALID_HANDLE_VALUE;
+            }
+#else
+            if(m_data){
+                munmap((void*)m_data, m_size);
+            }
+#endif
+            m_data = nullptr;
+            m_size = 0;
+        }
+        bool is_open()const{
+            return m_data != nullptr;
+        }
+        const char* data()const{
+            return m_data;
+        }
+        size_t size()const{
+            return m_size;
+        }
+        const std::string& path()const{
+            return m_path;
+        }
+
+    private:
+        std::string m_path;
+        const char* m_data {nullptr};
+        size_t m_size {0};
+#ifdef _WIN32
+        HANDLE m_file {INVALID_HANDLE_VALUE};
+        HANDLE m_mapping {NULL};
+#endif
+    };
+}
@@ -4,6 +4,13 @@
 
 using namespace med_qa;
 
+namespace {
+struct EDM_itemImpl{
+    EDManager::ItemRef ref;
+    std::string joined; //for the item spans fragments.
+};
+}
+
 EDM_manager edm_manager_create(){
     return new EDManager();
 }
@@ -20,11 +27,16 @@ void edm_manager_load(EDM_manager m, const char* encOutDesc){
 
 int edm_manager_getItem(EDM_manager m,const char* key, EDM_buffer* of){
     EDManager* edm = (EDManager*)m;
-    auto data = edm->getItem(key);
-    if(!data.empty()){
-        of->len = data.length() + 1;
+    //copied once, from the stored data to the buffer.
+    EDManager::ItemRef ref;
+    if(edm->getItemRef(key, ref) && ref.size > 0){
+        of->len = ref.size + 1;
         of->data = (char*)malloc(of->len);
-        memcpy(of->data, data.data(), data.length());
+        size_t pos = 0;
+        for(auto& sl : ref.slices){
+            memcpy(of->data + pos, sl.first, sl.second);
+            pos += sl.second;
+        }
         of->data[of->len-1] = '\0';
         return 1;
     }
@@ -37,3 +49,79 @@ void edm_manager_freeBufferData(struct EDM_buffer* buf){
     }
 }
 
+
+EDM_item edm_manager_getItemRef(EDM_manager m, const char* key){
+    EDManager* edm = (EDManager*)m;
+    auto item = new EDM_itemImpl();
+    if(!edm->getItemRef(key, item->ref)){
+        delete item;
+        return nullptr;
+    }
+    return item;
+}
+int edm_manager_getItemRefs(EDM_manager m, const char** keys, int count, EDM_item* out){
+    EDManager* edm = (EDManager*)m;
+    std::vector<std::string> _keys(keys, keys + count);
+    std::vector<EDManager::ItemRef> refs;
+    int found = edm->getItemRefs(_keys, refs);
+    for(int i = 0 ; i < count ; ++i){
+        if(refs[i].pin == nullptr){
+            out[i] = nullptr;
+            continue;
+        }
+        auto item = new EDM_itemImpl();
+        item->ref = std::move(refs[i]);
+        out[i] = item;
+    }
+    return found;
+}
+int edm_manager_readItem(EDM_manager m, const char* key, EDM_slice_func func, void* ctx){
+    EDManager* edm = (EDManager*)m;
+    EDManager::ItemRef ref;
+    if(!edm->getItemRef(key, ref)){
+        return 0;
+    }
+    for(auto& sl : ref.slices){
+        if(!func(ctx, sl.first, sl.second)){
+            return 0;
+        }
+    }
+    return 1;
+}
+unsigned long long edm_item_size(EDM_item _item){
+    EDM_itemImpl* item = (EDM_itemImpl*)_item;
+    return item->ref.size;
+}
+const char* edm_item_data(EDM_item _item, unsigned long long* len){
+    EDM_itemImpl* item = (EDM_itemImpl*)_item;
+    auto& slices = item->ref.slices;
+    if(len){
+        *len = item->ref.size;
+    }
+    if(slices.size() == 1){
+        return slices[0].first;
+    }
+    if(slices.empty()){
+        return "";
+    }
+    if(item->joined.empty()){
+        item->joined.reserve(item->ref.size);
+        for(auto& sl : slices){
+            item->joined.append(sl.first, sl.second);
+        }
+    }
+    return item->joined.data();
+}
+int edm_item_read(EDM_item _item, EDM_slice_func func, void* ctx){
+    EDM_itemImpl* item = (EDM_itemImpl*)_item;
+    for(auto& sl : item->ref.slices){
+        if(!func(ctx, sl.first, sl.second)){
+            return 0;
+        }
+    }
+    return 1;
+}
+void edm_item_release(EDM_item _item){
+    EDM_itemImpl* item = (EDM_itemImpl*)_item;
+    delete item;
+}
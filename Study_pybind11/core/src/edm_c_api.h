@@ -22,6 +22,33 @@ int edm_manager_getItem(EDM_manager m,const char* key, EDM_buffer* of);
 
 void edm_manager_freeBufferData(struct EDM_buffer*);
 
+//------------- zero copy -------------
+//borrowed item. its data is valid until 'edm_item_release', even if the manager
+//is changed or destroyed.
+typedef void* EDM_item;
+//called for every piece of the item data in order. return 0 to stop.
+typedef int (*EDM_slice_func)(void* ctx, const char* data, unsigned long long len);
+
+//NULL if the item doesn't exist or doesn't match its hash.
+EDM_item edm_manager_getItemRef(EDM_manager m, const char* key);
+
+//refs of 'count' keys under one lock. missing items are NULL. return the found count.
+int edm_manager_getItemRefs(EDM_manager m, const char** keys, int count, EDM_item* out);
+
+//stream the item data to 'func' without copy. 1 for success.
+int edm_manager_readItem(EDM_manager m, const char* key, EDM_slice_func func, void* ctx);
+
+unsigned long long edm_item_size(EDM_item item);
+
+//the data of the item, not null terminated. it is borrowed if the item is in one
+//fragment, or else joined once and kept by the item.
+const char* edm_item_data(EDM_item item, unsigned long long* len);
+
+//stream the item data to 'func' in order. 1 for success.
+int edm_item_read(EDM_item item, EDM_slice_func func, void* ctx);
+
+void edm_item_release(EDM_item item);
+
 #ifdef __cplusplus
 }
 #endif
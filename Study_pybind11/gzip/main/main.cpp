@@ -13,6 +13,9 @@ using namespace h7_gz;
 static void test1();
 static void test2();
 extern void test_Gzip1();
+extern void test_Gzip2();
+extern void test_CacheManager1();
+extern void test_EDManager1();
 extern void test_zip_cxqc(int argc, const char* argv[]);
 
 int main(int argc, const char* argv[]){
@@ -27,6 +30,14 @@ int main(int argc, const char* argv[]){
     setbuf(stdout, NULL);
     //test1();
     //test_Gzip1();
+    if(argc > 1 && String(argv[1]) == "--test"){
+        test1();
+        test_Gzip2();
+        test_CacheManager1();
+        test_EDManager1();
+        printf("all tests passed.\n");
+        return 0;
+    }
     test_zip_cxqc(argc, argv);
     return 0;
 }
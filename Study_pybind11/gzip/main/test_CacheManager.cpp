@@ -0,0 +1,686 @@
+#include "core/src/CacheManager.h"
+#include "core/src/FileUtils.h"
+#include "core/src/common.h"
+#include <functional>
+#include <atomic>
+#include <thread>
+
+using namespace h7;
+
+static void test_CacheManager11();
+static void test_CacheManager12();
+static void test_CacheManager13();
+static void test_CacheManager14();
+static void test_CacheManager15();
+static void test_CacheManager16();
+static void test_CacheManager17();
+static void test_CacheManager18();
+static void test_CacheManager19();
+static void test_CacheManager20();
+static void test_CacheManager21();
+static void test_CacheManager22();
+static void test_CacheManager23();
+static void test_CacheManager24();
+
+void test_CacheManager1(){
+    FileUtils::mkdirs("/tmp/h7_test/cm");
+    test_CacheManager11();
+    test_CacheManager12();
+    test_CacheManager13();
+    test_CacheManager14();
+    test_CacheManager15();
+    test_CacheManager16();
+    test_CacheManager17();
+    test_CacheManager18();
+    test_CacheManager19();
+    test_CacheManager20();
+    test_CacheManager21();
+    test_CacheManager22();
+    test_CacheManager23();
+    test_CacheManager24();
+}
+
+static void assertSorted(const std::vector<String>& names){
+    for(size_t i = 1 ; i < names.size() ; ++i){
+        MED_ASSERT(names[i - 1] < names[i]);
+    }
+}
+
+//listPrefix/listRange: name order, [first, last), removed items, saved directory.
+void test_CacheManager11(){
+    CacheManager cm(300);
+    for(int i = 0 ; i < 200 ; ++i){
+        String name = String(i % 3 == 0 ? "models/ocr/" : (i % 3 == 1 ? "models/det/" : "cfg/"))
+                + std::to_string(i * 7919 % 1000);
+        cm.addItem(name, name);
+    }
+    auto ocr = cm.listPrefix("models/ocr/");
+    MED_ASSERT(ocr.size() == 67);
+    assertSorted(ocr);
+    MED_ASSERT(cm.listPrefix("models/").size() == 134);
+    MED_ASSERT(cm.listPrefix("zz").empty());
+    MED_ASSERT(cm.listPrefix("").size() == 200);
+    //
+    auto range = cm.listRange("cfg/", "models/det/5");
+    MED_ASSERT(!range.empty());
+    assertSorted(range);
+    for(auto& n : range){
+        MED_ASSERT(n >= "cfg/" && n < "models/det/5");
+    }
+    //'last' is excluded, empty 'last' has no upper bound.
+    MED_ASSERT(cm.listRange(ocr[3], ocr[3]).empty());
+    auto tail = cm.listRange("models/det/", "");
+    MED_ASSERT(tail.size() == 134);
+    MED_ASSERT(tail.back() == ocr.back());
+    MED_ASSERT(cm.listRange("models/ocr/", "").size() == 67);
+    MED_ASSERT(cm.listRange("", "").size() == 200);
+    MED_ASSERT(cm.listRange("zz", "").empty());
+    MED_ASSERT(cm.listRange("b", "a").empty());
+    //
+    cm.removeItem(ocr[5]);
+    MED_ASSERT(cm.listPrefix("models/ocr/").size() == 66);
+    cm.addItem("models/ocr/!", "x");
+    MED_ASSERT(cm.listPrefix("models/ocr/")[0] == "models/ocr/!");
+    //
+    cm.compressTo("/tmp/h7_test/cm", "r", "d");
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        CacheManager c(1);
+        MED_ASSERT(c.load("/tmp/h7_test/cm", "r", "d", lazy));
+        MED_ASSERT(c.listPrefix("models/ocr/") == cm.listPrefix("models/ocr/"));
+        MED_ASSERT(c.listRange("cfg/", "models/det/5") == range);
+        MED_ASSERT(c.listRange("models/det/", "") == cm.listRange("models/det/", ""));
+    }
+    printf("test_CacheManager11 >> ok\n");
+}
+
+//packTo/loadPack round-trip, a truncated or corrupt pack is rejected.
+void test_CacheManager12(){
+    const String file = "/tmp/h7_test/cm/items.pk";
+    std::vector<String> datas;
+    for(int compress = 0 ; compress < 2 ; ++compress){
+        {
+            CacheManager cm(1 << 14);
+            cm.setBlockSize(4096);
+            datas.clear();
+            for(int i = 0 ; i < 40 ; ++i){
+                datas.push_back(String(2000 + i * 13, 'a' + i % 26));
+                cm.addItem("k" + std::to_string(i), datas.back());
+            }
+            cm.removeItem("k3");
+            MED_ASSERT(cm.packTo(file, compress));
+        }
+        for(int lazy = 0 ; lazy < 2 ; ++lazy){
+            CacheManager cm(1);
+            MED_ASSERT(cm.loadPack(file, lazy));
+            MED_ASSERT(cm.getItemCount() == 39);
+            for(int i = 0 ; i < 40 ; ++i){
+                String out;
+                cm.getItemData("k" + std::to_string(i), out);
+                MED_ASSERT(out == (i == 3 ? String() : datas[i]));
+            }
+        }
+    }
+    String all = FileUtils::getFileContent(file);
+    //corrupt counts in the record: item count, string table size, then random bytes.
+    {
+        uint64_t record_offset;
+        memcpy(&record_offset, all.data() + 16, sizeof(uint64_t));
+        auto loadModified = [&file, &all](uint64_t pos, uint32_t val){
+            String data = all;
+            memcpy(&data[pos], &val, sizeof(uint32_t));
+            MED_ASSERT(FileUtils::writeFile(file, data));
+            CacheManager cm(1);
+            return cm.loadPack(file, true);
+        };
+        MED_ASSERT(!loadModified(record_offset + 8, 0x7fffffff));
+        MED_ASSERT(!loadModified(record_offset + 29, 0xffffffff));
+        MED_ASSERT(!loadModified(record_offset + 12, 0x7fffffff));
+        uint32_t seed = 17;
+        for(int i = 0 ; i < 500 ; ++i){
+            seed = seed * 1103515245 + 12345;
+            uint64_t pos = record_offset + (seed >> 8) % (all.length() - record_offset - 3);
+            loadModified(pos, seed);
+        }
+    }
+    {
+        MED_ASSERT(FileUtils::writeFile(file, all.substr(0, all.length() / 2)));
+        CacheManager cm(1);
+        MED_ASSERT(!cm.loadPack(file));
+        MED_ASSERT(cm.getItemCount() == 0);
+    }
+    printf("test_CacheManager12 >> ok\n");
+}
+
+//a name added twice: lookups find the first alive item, a remove exposes the next.
+void test_CacheManager13(){
+    CacheManager cm(64);
+    cm.addItem("a", "first");
+    cm.addItem("b", "bbb");
+    cm.addItem("a", "second");
+    cm.addItem("a", "third");
+    String out;
+    cm.getItemData("a", out);
+    MED_ASSERT(out == "first");
+    cm.removeItem("a");
+    MED_ASSERT(cm.getItemCount() == 3);
+    out.clear();
+    cm.getItemData("a", out);
+    MED_ASSERT(out == "second");
+    cm.removeItem("a");
+    out.clear();
+    cm.getItemData("a", out);
+    MED_ASSERT(out == "third");
+    cm.removeItem("a");
+    MED_ASSERT(cm.getItemCount() == 1);
+    out.clear();
+    cm.getItemData("a", out);
+    MED_ASSERT(out.empty());
+    cm.removeItem("a");
+    MED_ASSERT(cm.getItemCount() == 1);
+    //a name added again after its remove.
+    cm.addItem("a", "again");
+    cm.addItem("a", "again2");
+    cm.removeItem("a");
+    out.clear();
+    cm.getItemData("a", out);
+    MED_ASSERT(out == "again2");
+    //the save keeps it found by name.
+    cm.compressTo("/tmp/h7_test/cm", "dup", "dupd");
+    CacheManager c(1);
+    MED_ASSERT(c.load("/tmp/h7_test/cm", "dup", "dupd"));
+    MED_ASSERT(c.getItemCount() == 2);
+    out.clear();
+    c.getItemData("a", out);
+    MED_ASSERT(out == "again2");
+    printf("test_CacheManager13 >> ok\n");
+}
+
+static String test_cm_data(int i, int len){
+    String s;
+    s.resize(len);
+    for(int k = 0 ; k < len ; ++k){
+        s[k] = (char)('a' + (i * 13 + k / 3) % 26);
+    }
+    return s;
+}
+static int test_cm_len(int i){
+    return i == 50 ? 20000 : 300 + i * 131 % 1200;
+}
+static void test_cm_check(CacheManager& cm, int count, std::function<bool(int)> removed){
+    uint32_t alive = 0;
+    for(int i = 0 ; i < count ; ++i){
+        String out;
+        cm.getItemData("k" + std::to_string(i), out);
+        if(removed(i)){
+            MED_ASSERT(out.empty());
+        }else{
+            MED_ASSERT(out == test_cm_data(i, test_cm_len(i)));
+            alive ++;
+        }
+    }
+    MED_ASSERT(cm.getItemCount() == alive);
+}
+
+//removed items are dropped before a save, only the fragments which hold them are
+//rewritten. lazy fragments moved to a lower id are saved in place correctly.
+void test_CacheManager14(){
+    const int count = 200;
+    auto removed1 = [](int i){ return i % 7 == 3 || i == 50; };
+    {
+        CacheManager cm(4096);
+        cm.setBlockSize(1024);
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+        }
+        cm.compressTo("/tmp/h7_test/cm", "c6", "c6d");
+        //'k50' covers whole fragments, they are dropped and the later ids move down.
+        for(int i = 0 ; i < count ; ++i){
+            if(removed1(i)){
+                cm.removeItem("k" + std::to_string(i));
+            }
+        }
+        MED_ASSERT(cm.getFreeSize() > 20000);
+        cm.compressTo("/tmp/h7_test/cm", "c6a", "c6ad");
+        MED_ASSERT(cm.getFreeSize() == 0);
+        test_cm_check(cm, count, removed1);
+    }
+    {
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "c6a", "c6ad"));
+        test_cm_check(cm, count, removed1);
+    }
+    //lazy, saved in place: only the dirty fragments are read.
+    auto removed2 = [](int i){ return i == 50 || i == 150; };
+    {
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "c6", "c6d", true));
+        cm.removeItem("k50");
+        cm.removeItem("k150");
+        cm.compressTo("/tmp/h7_test/cm", "c6", "c6d");
+        MED_ASSERT(cm.getBlockCacheStats().misses < 20);
+        test_cm_check(cm, count, removed2);
+    }
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "c6", "c6d", lazy));
+        test_cm_check(cm, count, removed2);
+    }
+    //the unused data shared by merge is only dropped by 'compact'.
+    {
+        CacheManager a(4096);
+        a.addItem("k100", test_cm_data(100, test_cm_len(100)));
+        CacheManager b(1);
+        MED_ASSERT(b.load("/tmp/h7_test/cm", "c6a", "c6ad", true));
+        a.merge(b);
+        a.removeItem("k1");
+        const auto freeSize = a.getFreeSize();
+        MED_ASSERT(freeSize > 0);
+        a.saveTo("/tmp/h7_test/cm", "c6m", "c6md");
+        MED_ASSERT(a.getFreeSize() > 0 && a.getFreeSize() < freeSize);
+        a.compact();
+        MED_ASSERT(a.getFreeSize() == 0);
+        auto removed3 = [&removed1](int i){ return removed1(i) || i == 1; };
+        test_cm_check(a, count, removed3);
+        CacheManager c(1);
+        MED_ASSERT(c.load("/tmp/h7_test/cm", "c6m", "c6md"));
+        test_cm_check(c, count, removed3);
+    }
+    //a remove while streaming only rewrites its fragment at the end.
+    {
+        CacheManager cm(4096);
+        MED_ASSERT(cm.beginStream("/tmp/h7_test/cm", "c6s", "c6sd"));
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+            if(i == 60){
+                cm.removeItem("k50");
+                cm.removeItem("k3");
+            }
+        }
+        cm.endStream();
+        CacheManager c(1);
+        MED_ASSERT(c.load("/tmp/h7_test/cm", "c6s", "c6sd", true));
+        test_cm_check(c, count, [](int i){ return i == 3 || i == 50; });
+    }
+    printf("test_CacheManager14 >> ok\n");
+}
+
+//lazy reads keep the uncompressed blocks in the budget, one stream fragments too.
+void test_CacheManager15(){
+    const int count = 200;
+    for(uint32_t blockSize : {1024u, 0u}){
+        {
+            CacheManager cm(8192);
+            cm.setBlockSize(blockSize);
+            for(int i = 0 ; i < count ; ++i){
+                cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+            }
+            cm.compressTo("/tmp/h7_test/cm", "c8", "c8d");
+        }
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "c8", "c8d", true));
+        cm.setBlockCacheBudget(20000);
+        test_cm_check(cm, count, [](int){ return false; });
+        auto stats = cm.getBlockCacheStats();
+        MED_ASSERT(stats.used_size > 0 && stats.used_size <= 20000);
+        MED_ASSERT(stats.evictions > 0);
+        //read again: hits for the kept ones.
+        String out;
+        cm.getItemData("k199", out);
+        MED_ASSERT(cm.getBlockCacheStats().hits > stats.hits);
+        //a zero budget keeps nothing, reads still work.
+        cm.setBlockCacheBudget(0);
+        MED_ASSERT(cm.getBlockCacheStats().used_size == 0);
+        test_cm_check(cm, count, [](int){ return false; });
+        MED_ASSERT(cm.getBlockCacheStats().used_size == 0);
+    }
+    printf("test_CacheManager15 >> ok\n");
+}
+
+//lazy load: the same items as a full load, only the touched fragments are read.
+//a lazy store saved in place over its own files.
+void test_CacheManager16(){
+    const int count = 200;
+    {
+        CacheManager cm(4096);
+        cm.setBlockSize(0);
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+        }
+        cm.compressTo("/tmp/h7_test/cm", "l1", "l1d");
+        cm.saveTo("/tmp/h7_test/cm", "l1u", "l1ud");
+    }
+    {
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "l1", "l1d", true));
+        MED_ASSERT(cm.getItemCount() == count);
+        String out;
+        cm.getItemData("k7", out);
+        MED_ASSERT(out == test_cm_data(7, test_cm_len(7)));
+        //one stream fragments: at most the two which 'k7' spans.
+        MED_ASSERT(cm.getBlockCacheStats().misses <= 2);
+        test_cm_check(cm, count, [](int){ return false; });
+    }
+    //uncompressed: the mapped file is the data.
+    {
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "l1u", "l1ud", true));
+        test_cm_check(cm, count, [](int){ return false; });
+        MED_ASSERT(cm.getBlockCacheStats().misses == 0);
+        //saved over the mapped files, with a new item in the last fragment.
+        cm.addItem("k" + std::to_string(count), test_cm_data(count, test_cm_len(count)));
+        cm.saveTo("/tmp/h7_test/cm", "l1u", "l1ud");
+        test_cm_check(cm, count + 1, [](int){ return false; });
+    }
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "l1u", "l1ud", lazy));
+        test_cm_check(cm, count + 1, [](int){ return false; });
+    }
+    printf("test_CacheManager16 >> ok\n");
+}
+
+static String test_cm_join(const CacheManager::ItemView& v){
+    String s;
+    for(auto& slice : v.slices){
+        s.append(slice.data, slice.len);
+    }
+    return s;
+}
+
+//views: one slice in a fragment, one per fragment across them. the pin outlives
+//the remove and the reset, for resident and lazy stores.
+void test_CacheManager17(){
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        CacheManager cm(4096);
+        cm.setItemHash(true);
+        for(int i = 0 ; i < 100 ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+        }
+        if(lazy){
+            cm.setBlockSize(1024);
+            cm.compressTo("/tmp/h7_test/cm", "v3", "v3d");
+            MED_ASSERT(cm.load("/tmp/h7_test/cm", "v3", "v3d", true));
+        }
+        CacheManager::ItemView small, big;
+        MED_ASSERT(cm.getItemView("k0", small, true));
+        MED_ASSERT(small.size == (uint64_t)test_cm_len(0));
+        MED_ASSERT(test_cm_join(small) == test_cm_data(0, test_cm_len(0)));
+        if(!lazy){
+            MED_ASSERT(small.isContiguous());
+        }
+        MED_ASSERT(cm.getItemView("k50", big, true));
+        MED_ASSERT(!big.isContiguous() && big.slices.size() >= 5);
+        MED_ASSERT(big.size == 20000);
+        cm.removeItem("k50");
+        CacheManager::ItemView none;
+        MED_ASSERT(!cm.getItemView("k50", none));
+        cm.reset();
+        MED_ASSERT(test_cm_join(big) == test_cm_data(50, 20000));
+        MED_ASSERT(test_cm_join(small) == test_cm_data(0, test_cm_len(0)));
+    }
+    //a compressed item is viewed as stored.
+    CacheManager cm(4096);
+    String raw = test_cm_data(1, 3000);
+    cm.addItemCompressed("c", raw);
+    CacheManager::ItemView v;
+    MED_ASSERT(cm.getItemView("c", v));
+    MED_ASSERT(v.size < raw.size());
+    String out;
+    cm.getItemDataUnCompressed("c", out);
+    MED_ASSERT(out == raw);
+    printf("test_CacheManager17 >> ok\n");
+}
+
+//parallel compressTo writes the same files as one thread, parallel loads read them back.
+void test_CacheManager18(){
+    const int count = 300;
+    for(uint32_t blockSize : {0u, 1024u}){
+        for(int tc : {1, 4}){
+            CacheManager cm(4096);
+            cm.setBlockSize(blockSize);
+            cm.setThreadCount(tc);
+            for(int i = 0 ; i < count ; ++i){
+                cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+            }
+            cm.compressTo("/tmp/h7_test/cm", "p" + std::to_string(tc),
+                          "p" + std::to_string(tc) + "d");
+        }
+        for(int i = 0 ; ; ++i){
+            String f1 = "/tmp/h7_test/cm/p1d" + std::to_string(i) + ".dt";
+            String f4 = "/tmp/h7_test/cm/p4d" + std::to_string(i) + ".dt";
+            if(!FileUtils::isFileExists(f1)){
+                MED_ASSERT(i > 10);
+                break;
+            }
+            MED_ASSERT(FileUtils::getFileContent(f1) == FileUtils::getFileContent(f4));
+        }
+        for(int lazy = 0 ; lazy < 2 ; ++lazy){
+            CacheManager cm(1);
+            cm.setThreadCount(4);
+            MED_ASSERT(cm.load("/tmp/h7_test/cm", "p4", "p4d", lazy));
+            test_cm_check(cm, count, [](int){ return false; });
+        }
+    }
+    printf("test_CacheManager18 >> ok\n");
+}
+
+//blocks: a lazy read only uncompresses the blocks the item overlaps. any block size
+//round-trips, one bigger than the fragment too.
+void test_CacheManager19(){
+    const int count = 100;
+    for(uint32_t blockSize : {1000u, 4096u, 100000u}){
+        {
+            CacheManager cm(8192);
+            cm.setBlockSize(blockSize);
+            for(int i = 0 ; i < count ; ++i){
+                cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+            }
+            cm.compressTo("/tmp/h7_test/cm", "b5", "b5d");
+        }
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "b5", "b5d", true));
+        String out;
+        cm.getItemData("k7", out);
+        MED_ASSERT(out == test_cm_data(7, test_cm_len(7)));
+        auto misses = cm.getBlockCacheStats().misses;
+        MED_ASSERT(misses >= 1 && misses <= (test_cm_len(7) + blockSize - 1) / blockSize + 1);
+        cm.getItemData("k7", out);
+        MED_ASSERT(cm.getBlockCacheStats().misses == misses);
+        test_cm_check(cm, count, [](int){ return false; });
+        CacheManager c(1);
+        MED_ASSERT(c.load("/tmp/h7_test/cm", "b5", "b5d"));
+        test_cm_check(c, count, [](int){ return false; });
+    }
+    printf("test_CacheManager19 >> ok\n");
+}
+
+//streaming: full fragments are on disk before 'endStream', the result loads like
+//'compressTo'. only an empty manager can stream.
+void test_CacheManager20(){
+    const int count = 300;
+    const String dataFile = "/tmp/h7_test/cm/s7d0.dt";
+    remove(dataFile.data());
+    {
+        CacheManager busy(4096);
+        busy.addItem("a", "b");
+        MED_ASSERT(!busy.beginStream("/tmp/h7_test/cm", "s7", "s7d"));
+    }
+    {
+        CacheManager cm(4096);
+        cm.setBlockSize(1024);
+        MED_ASSERT(cm.beginStream("/tmp/h7_test/cm", "s7", "s7d"));
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+            if(i == 10){
+                MED_ASSERT(FileUtils::isFileExists(dataFile));
+            }
+        }
+        cm.endStream();
+        //still readable after the stream.
+        test_cm_check(cm, count, [](int){ return false; });
+    }
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "s7", "s7d", lazy));
+        test_cm_check(cm, count, [](int){ return false; });
+    }
+    printf("test_CacheManager20 >> ok\n");
+}
+
+//concurrent reads on a lazy store with a small block cache: copies, views and lists.
+void test_CacheManager21(){
+    const int count = 300;
+    {
+        CacheManager cm(4096);
+        cm.setBlockSize(1024);
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+        }
+        cm.compressTo("/tmp/h7_test/cm", "r9", "r9d");
+    }
+    for(uint64_t budget : {(uint64_t)8192, (uint64_t)1 << 20}){
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "r9", "r9d", true));
+        cm.setBlockCacheBudget(budget);
+        std::atomic<int> bad {0};
+        std::vector<std::thread> ths;
+        for(int t = 0 ; t < 8 ; ++t){
+            ths.emplace_back([&cm, &bad, t, count](){
+                for(int r = 0 ; r < 3 ; ++r){
+                    for(int k = 0 ; k < count ; ++k){
+                        int i = (k * 7 + t * 31) % count;
+                        String name = "k" + std::to_string(i);
+                        String out;
+                        cm.getItemData(name, out);
+                        CacheManager::ItemView v;
+                        if(out != test_cm_data(i, test_cm_len(i)) || !cm.getItemView(name, v)
+                                || test_cm_join(v) != out){
+                            bad ++;
+                        }
+                    }
+                    if(cm.listPrefix("k1").size() != 111 || cm.getItemCount() != (uint32_t)count){
+                        bad ++;
+                    }
+                }
+            });
+        }
+        for(auto& th : ths){
+            th.join();
+        }
+        MED_ASSERT(bad == 0);
+        MED_ASSERT(cm.getBlockCacheStats().used_size <= budget);
+    }
+    printf("test_CacheManager21 >> ok\n");
+}
+
+//item hashes survive a save, a changed byte of the data file is caught on read.
+void test_CacheManager22(){
+    const int count = 50;
+    const String dataFile = "/tmp/h7_test/cm/h10d0.dt";
+    {
+        CacheManager cm(1 << 20);
+        cm.setItemHash(true);
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+        }
+        cm.saveTo("/tmp/h7_test/cm", "h10", "h10d");
+    }
+    {
+        CacheManager cm(1);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "h10", "h10d", true));
+        test_cm_check(cm, count, [](int){ return false; });
+        MED_ASSERT(cm.verifyAll());
+    }
+    //'k0' is at the start of the only fragment.
+    String all = FileUtils::getFileContent(dataFile);
+    all[5] ^= 0x1;
+    MED_ASSERT(FileUtils::writeFile(dataFile, all));
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        CacheManager cm(1);
+        cm.setThreadCount(4);
+        MED_ASSERT(cm.load("/tmp/h7_test/cm", "h10", "h10d", lazy));
+        String out;
+        cm.getItemData("k0", out);
+        MED_ASSERT(out.empty());
+        cm.getItemData("k1", out);
+        MED_ASSERT(out == test_cm_data(1, test_cm_len(1)));
+        CacheManager::ItemView v;
+        MED_ASSERT(cm.getItemView("k0", v));
+        MED_ASSERT(!cm.getItemView("k0", v, true));
+        std::vector<String> bad;
+        MED_ASSERT(!cm.verifyAll(&bad));
+        MED_ASSERT(bad.size() == 1 && bad[0] == "k0");
+    }
+    printf("test_CacheManager22 >> ok\n");
+}
+
+//names of any length round-trip through the string table, short names keep the
+//record small.
+void test_CacheManager23(){
+    std::vector<String> names;
+    uint64_t nameBytes = 0;
+    for(int i = 0 ; i < 300 ; ++i){
+        names.push_back(i % 10 == 0 ? String(100 + i * 7, 'a' + i % 26) + std::to_string(i)
+                                    : "n" + std::to_string(i));
+        nameBytes += names.back().length();
+    }
+    {
+        CacheManager cm(4096);
+        for(int i = 0 ; i < 300 ; ++i){
+            cm.addItem(names[i], test_cm_data(i, 50));
+        }
+        cm.compressTo("/tmp/h7_test/cm", "n11", "n11d");
+        cm.packTo("/tmp/h7_test/cm/n11.pk");
+    }
+    auto recordSize = FileUtils::getFileContent("/tmp/h7_test/cm/n11.dr").length();
+    //no fixed size name slot per item.
+    MED_ASSERT(recordSize < nameBytes + 300 * 64);
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        for(int pack = 0 ; pack < 2 ; ++pack){
+            CacheManager cm(1);
+            MED_ASSERT(pack ? cm.loadPack("/tmp/h7_test/cm/n11.pk", lazy)
+                            : cm.load("/tmp/h7_test/cm", "n11", "n11d", lazy));
+            MED_ASSERT(cm.getItemNames() == names);
+            for(int i = 0 ; i < 300 ; ++i){
+                String out;
+                cm.getItemData(names[i], out);
+                MED_ASSERT(out == test_cm_data(i, 50));
+            }
+            String name, data;
+            cm.getItemAt(290, name, data);
+            MED_ASSERT(name == names[290] && name.length() > 2000);
+        }
+    }
+    printf("test_CacheManager23 >> ok\n");
+}
+
+//prefetch warms the blocks of the items, later reads of them are hits.
+void test_CacheManager24(){
+    const int count = 100;
+    {
+        CacheManager cm(8192);
+        cm.setBlockSize(1024);
+        for(int i = 0 ; i < count ; ++i){
+            cm.addItem("k" + std::to_string(i), test_cm_data(i, test_cm_len(i)));
+        }
+        cm.compressTo("/tmp/h7_test/cm", "f19", "f19d");
+    }
+    CacheManager cm(1);
+    cm.setThreadCount(4);
+    MED_ASSERT(cm.load("/tmp/h7_test/cm", "f19", "f19d", true));
+    std::vector<String> names;
+    for(int i = 0 ; i < count ; i += 2){
+        names.push_back("k" + std::to_string(i));
+    }
+    names.push_back("none");
+    MED_ASSERT(cm.prefetch(names) == (uint32_t)count / 2);
+    auto misses = cm.getBlockCacheStats().misses;
+    MED_ASSERT(misses > 0);
+    for(int i = 0 ; i < count ; i += 2){
+        String out;
+        cm.getItemData("k" + std::to_string(i), out);
+        MED_ASSERT(out == test_cm_data(i, test_cm_len(i)));
+    }
+    MED_ASSERT(cm.getBlockCacheStats().misses == misses);
+    printf("test_CacheManager24 >> ok\n");
+}
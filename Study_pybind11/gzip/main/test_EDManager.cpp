@@ -0,0 +1,366 @@
+#include "core/src/EDManager.h"
+#include "core/src/CacheManager.h"
+#include "core/src/edm_c_api.h"
+#include "core/src/FileUtils.h"
+#include "core/src/common.h"
+#include <atomic>
+#include <map>
+#include <thread>
+
+using namespace h7;
+using namespace med_qa;
+
+#define TEST_ED_DIR "/tmp/h7_test/ed"
+
+static void test_EDManager11();
+static void test_EDManager12();
+static void test_EDManager13();
+static void test_EDManager14();
+static void test_EDManager15();
+static void test_EDManager16();
+static void test_EDManager17();
+static void test_EDManager18();
+
+void test_EDManager1(){
+    FileUtils::mkdirs(TEST_ED_DIR);
+    test_EDManager11();
+    test_EDManager12();
+    test_EDManager13();
+    test_EDManager14();
+    test_EDManager15();
+    test_EDManager16();
+    test_EDManager17();
+    test_EDManager18();
+}
+
+static String test_ed_data(int i, int len){
+    String s;
+    s.resize(len);
+    for(int k = 0 ; k < len ; ++k){
+        s[k] = (char)('a' + (i * 7 + k) % 26);
+    }
+    return s;
+}
+
+//a store of 'count' plain items, written to 'record'.
+static void test_ed_writeStore(CString record, int count){
+    CacheManager cm(1 << 16);
+    for(int i = 0 ; i < count ; ++i){
+        cm.addItem("k" + std::to_string(i), test_ed_data(i, 100 + i * 97 % 5000));
+    }
+    cm.compressTo(TEST_ED_DIR, record, record + "_d");
+}
+
+//salted export on the pipeline: items come back in order and decoded.
+void test_EDManager11(){
+    test_ed_writeStore("plain", 300);
+    for(int tc : {1, 4}){
+        EDManager ed;
+        ed.setThreadCount(tc);
+        ed.load(TEST_ED_DIR ",plain,plain_d");
+        ed.compressTo(TEST_ED_DIR ",salted,salted_d", "s@lt");
+        //stored salted.
+        CacheManager raw(1);
+        MED_ASSERT(raw.load(TEST_ED_DIR, "salted", "salted_d"));
+        MED_ASSERT(raw.getItemCount() == 301);
+        String name, data;
+        raw.getItemAt(0, name, data);
+        MED_ASSERT(name == "k0");
+        MED_ASSERT(data != test_ed_data(0, 100));
+        //decoded on read, and salted again with a new salt.
+        EDManager e2;
+        e2.setThreadCount(tc);
+        e2.load(TEST_ED_DIR ",salted,salted_d");
+        for(int i = 0 ; i < 300 ; ++i){
+            MED_ASSERT(e2.getItem("k" + std::to_string(i)) == test_ed_data(i, 100 + i * 97 % 5000));
+        }
+        e2.compressTo(TEST_ED_DIR ",salted2,salted2_d", "other");
+        EDManager e3;
+        e3.load(TEST_ED_DIR ",salted2,salted2_d");
+        MED_ASSERT(e3.getItem("k299") == test_ed_data(299, 100 + 299 * 97 % 5000));
+    }
+    printf("test_EDManager11 >> ok\n");
+}
+
+//getItem from many threads at once, lazy and resident.
+void test_EDManager12(){
+    test_ed_writeStore("plain", 300);
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        EDManager ed;
+        ed.setLazyLoad(lazy);
+        ed.setBlockCacheBudget(64 << 10);
+        ed.load(TEST_ED_DIR ",plain,plain_d");
+        std::atomic<int> bad {0};
+        std::vector<std::thread> ths;
+        for(int t = 0 ; t < 8 ; ++t){
+            ths.emplace_back([&ed, &bad, t](){
+                for(int k = 0 ; k < 300 ; ++k){
+                    int i = (k * 11 + t * 37) % 300;
+                    if(ed.getItem("k" + std::to_string(i)) != test_ed_data(i, 100 + i * 97 % 5000)){
+                        bad ++;
+                    }
+                }
+            });
+        }
+        for(auto& th : ths){
+            th.join();
+        }
+        MED_ASSERT(bad == 0);
+    }
+    printf("test_EDManager12 >> ok\n");
+}
+
+//a salted store is decoded on read, eager or lazy. new items in it are read back
+//decoded, a plain export writes them unsalted.
+void test_EDManager13(){
+    test_ed_writeStore("plain", 300);
+    {
+        EDManager ed;
+        ed.load(TEST_ED_DIR ",plain,plain_d");
+        ed.compressTo(TEST_ED_DIR ",salted,salted_d", "s@lt");
+    }
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        EDManager ed;
+        ed.setLazyLoad(lazy);
+        ed.load(TEST_ED_DIR ",salted,salted_d");
+        for(int i = 0 ; i < 300 ; i += 7){
+            String data = test_ed_data(i, 100 + i * 97 % 5000);
+            MED_ASSERT(ed.getItem("k" + std::to_string(i)) == data);
+            EDManager::ItemRef ref;
+            MED_ASSERT(ed.getItemRef("k" + std::to_string(i), ref));
+            MED_ASSERT(ref.size == data.length() && ref.slices.size() == 1);
+            MED_ASSERT(String(ref.slices[0].first, ref.slices[0].second) == data);
+        }
+        ed.addItem("new", "new data");
+        ed.addItem("k1", "changed");
+        ed.removeItem("k2");
+        MED_ASSERT(ed.getItem("new") == "new data");
+        MED_ASSERT(ed.getItem("k1") == "changed");
+        MED_ASSERT(ed.getItem("k2").empty());
+        ed.compressTo(TEST_ED_DIR ",unsalted,unsalted_d");
+        CacheManager raw(1);
+        MED_ASSERT(raw.load(TEST_ED_DIR, "unsalted", "unsalted_d"));
+        MED_ASSERT(raw.getItemCount() == 300);
+        String out;
+        raw.getItemData("k1", out);
+        MED_ASSERT(out == "changed");
+        raw.getItemData("k299", out);
+        MED_ASSERT(out == test_ed_data(299, 100 + 299 * 97 % 5000));
+    }
+    printf("test_EDManager13 >> ok\n");
+}
+
+//'count' items from 'first', with the data of 'version'.
+static void test_ed_writeRange(CString record, int first, int count, int version){
+    CacheManager cm(1 << 16);
+    for(int i = first ; i < first + count ; ++i){
+        cm.addItem("k" + std::to_string(i), test_ed_data(i + version, 100 + i * 97 % 5000));
+    }
+    cm.compressTo(TEST_ED_DIR, record, record + "_d");
+}
+
+//merge keeps the items of the main manager, the others come from 'oth' and stay
+//readable after it is gone. salted and plain stores merge too.
+void test_EDManager14(){
+    test_ed_writeRange("ma", 0, 150, 0);
+    test_ed_writeRange("mb", 100, 200, 1);
+    {
+        EDManager b;
+        b.load(TEST_ED_DIR ",mb,mb_d");
+        b.compressTo(TEST_ED_DIR ",mbs,mbs_d", "s@lt");
+    }
+    auto check = [](EDManager& ed, int high){
+        for(int i = 0 ; i < 300 ; ++i){
+            int version = i < 100 ? 0 : (i >= 150 ? 1 : high);
+            MED_ASSERT(ed.getItem("k" + std::to_string(i))
+                       == test_ed_data(i + version, 100 + i * 97 % 5000));
+        }
+    };
+    for(CString other : {String(TEST_ED_DIR ",mb,mb_d"), String(TEST_ED_DIR ",mbs,mbs_d")}){
+        for(int lazy = 0 ; lazy < 2 ; ++lazy){
+            EDManager a;
+            a.setLazyLoad(lazy);
+            a.load(TEST_ED_DIR ",ma,ma_d");
+            {
+                EDManager b;
+                b.setLazyLoad(lazy);
+                b.load(other);
+                MED_ASSERT(a.merge(b) == &a);
+            }
+            check(a, 0);
+            a.compressTo(TEST_ED_DIR ",mab,mab_d");
+            EDManager c;
+            c.load(TEST_ED_DIR ",mab,mab_d");
+            check(c, 0);
+        }
+        //'oth' first.
+        EDManager a, b;
+        a.load(TEST_ED_DIR ",ma,ma_d");
+        b.load(other);
+        MED_ASSERT(a.mergeByPriority(b, false) == &b);
+        check(b, 1);
+    }
+    printf("test_EDManager14 >> ok\n");
+}
+
+//compress from files: every matched file becomes an item keyed by its path under
+//the dir, in order, with its hash kept.
+void test_EDManager15(){
+    const String src = TEST_ED_DIR "/src";
+    FileUtils::mkdirs(src + "/a");
+    FileUtils::mkdirs(src + "/b");
+    std::map<String, String> files;
+    for(int i = 0 ; i < 40 ; ++i){
+        String key = String(i % 2 ? "/a/" : "/b/") + "f" + std::to_string(i) + ".bin";
+        files[key] = test_ed_data(i, i == 7 ? 3 << 20 : 10 + i * 1013);
+        MED_ASSERT(FileUtils::writeFile(src + key, files[key]));
+    }
+    MED_ASSERT(FileUtils::writeFile(src + "/a/skip.txt", "skip"));
+    for(int tc : {1, 4}){
+        EDManager ed(src, ".bin", TEST_ED_DIR ",files,files_d");
+        ed.setThreadCount(tc);
+        ed.compress(true);
+        MED_ASSERT(ed.getKeys().size() == files.size());
+        CacheManager cm(1);
+        MED_ASSERT(cm.load(TEST_ED_DIR, "files", "files_d", true));
+        MED_ASSERT(cm.getItemNames() == ed.getKeys());
+        MED_ASSERT(cm.verifyAll());
+        for(auto& it : files){
+            String out;
+            cm.getItemData(it.first, out);
+            MED_ASSERT(out == it.second);
+        }
+    }
+    printf("test_EDManager15 >> ok\n");
+}
+
+//layers: the top layer wins, its whiteouts hide the items below. a patch written by
+//'compressLayerTo' mounts the same view again, 'compressTo' flattens it.
+void test_EDManager16(){
+    test_ed_writeRange("base", 0, 100, 0);
+    auto check = [](EDManager& ed){
+        MED_ASSERT(ed.getItem("k1") == "patched");
+        MED_ASSERT(ed.getItem("k2").empty());
+        MED_ASSERT(ed.getItem("added") == "new");
+        MED_ASSERT(ed.getItem("k3") == test_ed_data(3, 100 + 3 * 97 % 5000));
+        auto keys = ed.listPrefix("k");
+        MED_ASSERT(keys.size() == 99);
+        MED_ASSERT(std::find(keys.begin(), keys.end(), "k2") == keys.end());
+        MED_ASSERT(ed.listPrefix("a") == List<String>{"added"});
+    };
+    for(int lazy = 0 ; lazy < 2 ; ++lazy){
+        {
+            EDManager ed;
+            ed.setLazyLoad(lazy);
+            ed.load(TEST_ED_DIR ",base,base_d");
+            ed.addLayer("");
+            MED_ASSERT(ed.getLayerCount() == 2);
+            ed.addItem("k1", "patched");
+            ed.removeItem("k2");
+            ed.addItem("added", "new");
+            check(ed);
+            ed.compressLayerTo(TEST_ED_DIR ",patch,patch_d");
+            ed.compressTo(TEST_ED_DIR ",flat,flat_d");
+        }
+        //the base is unchanged.
+        EDManager base;
+        base.load(TEST_ED_DIR ",base,base_d");
+        MED_ASSERT(base.getItem("k1") == test_ed_data(1, 100 + 97));
+        MED_ASSERT(!base.getItem("k2").empty());
+        //
+        EDManager ed;
+        ed.setLazyLoad(lazy);
+        ed.load(TEST_ED_DIR ",base,base_d");
+        ed.addLayer(TEST_ED_DIR ",patch,patch_d");
+        check(ed);
+        //an item added again over its whiteout.
+        ed.addItem("k2", "back");
+        MED_ASSERT(ed.getItem("k2") == "back");
+        EDManager flat;
+        flat.load(TEST_ED_DIR ",flat,flat_d");
+        MED_ASSERT(flat.getLayerCount() == 1);
+        check(flat);
+    }
+    printf("test_EDManager16 >> ok\n");
+}
+
+static int test_ed_appendSlice(void* ctx, const char* data, unsigned long long len){
+    ((String*)ctx)->append(data, len);
+    return 1;
+}
+static int test_ed_stopSlice(void* ctx, const char*, unsigned long long){
+    (*(int*)ctx) ++;
+    return 0;
+}
+
+//the c api: copied, borrowed, batched and streamed reads. a borrowed item outlives
+//its manager.
+void test_EDManager17(){
+    test_ed_writeStore("plain", 300);
+    EDM_manager m = edm_manager_create();
+    edm_manager_load(m, TEST_ED_DIR ",plain,plain_d");
+    //copied, null terminated.
+    EDM_buffer buf;
+    MED_ASSERT(edm_manager_getItem(m, "k5", &buf) == 1);
+    MED_ASSERT(buf.len == 100 + 5 * 97 % 5000 + 1 && buf.data[buf.len - 1] == '\0');
+    MED_ASSERT(String(buf.data, buf.len - 1) == test_ed_data(5, 100 + 5 * 97 % 5000));
+    edm_manager_freeBufferData(&buf);
+    MED_ASSERT(buf.data == nullptr);
+    MED_ASSERT(edm_manager_getItem(m, "none", &buf) == 0);
+    //borrowed, the batch has a null for a missing key.
+    const char* keys[] = {"k1", "none", "k200"};
+    EDM_item items[3];
+    MED_ASSERT(edm_manager_getItemRefs(m, keys, 3, items) == 2);
+    MED_ASSERT(items[1] == nullptr);
+    MED_ASSERT(edm_manager_getItemRef(m, "none") == nullptr);
+    EDM_item one = edm_manager_getItemRef(m, "k250");
+    MED_ASSERT(one != nullptr);
+    //streamed, stopped by the callback.
+    String streamed;
+    MED_ASSERT(edm_manager_readItem(m, "k9", test_ed_appendSlice, &streamed) == 1);
+    MED_ASSERT(streamed == test_ed_data(9, 100 + 9 * 97 % 5000));
+    int calls = 0;
+    MED_ASSERT(edm_manager_readItem(m, "k9", test_ed_stopSlice, &calls) == 0);
+    MED_ASSERT(calls == 1);
+    edm_manager_destroy(m);
+    //
+    for(int i : {0, 2}){
+        int idx = i == 0 ? 1 : 200;
+        String data = test_ed_data(idx, 100 + idx * 97 % 5000);
+        unsigned long long len = 0;
+        const char* p = edm_item_data(items[i], &len);
+        MED_ASSERT(len == data.length() && edm_item_size(items[i]) == len);
+        MED_ASSERT(String(p, len) == data);
+        String read;
+        MED_ASSERT(edm_item_read(items[i], test_ed_appendSlice, &read) == 1);
+        MED_ASSERT(read == data);
+        edm_item_release(items[i]);
+    }
+    unsigned long long len = 0;
+    const char* p = edm_item_data(one, &len);
+    MED_ASSERT(String(p, len) == test_ed_data(250, 100 + 250 * 97 % 5000));
+    edm_item_release(one);
+    printf("test_EDManager17 >> ok\n");
+}
+
+//prefetch on the background thread: the future and the callback get the found count.
+void test_EDManager18(){
+    test_ed_writeStore("plain", 300);
+    EDManager ed;
+    ed.setLazyLoad(true);
+    ed.load(TEST_ED_DIR ",plain,plain_d");
+    List<String> keys;
+    for(int i = 0 ; i < 300 ; i += 3){
+        keys.push_back("k" + std::to_string(i));
+    }
+    keys.push_back("none");
+    std::atomic<int> called {-1};
+    auto f = ed.prefetch(keys, [&called](int n){ called = n; });
+    MED_ASSERT(f.get() == 100);
+    MED_ASSERT(called == 100);
+    MED_ASSERT(ed.prefetch({"none"}).get() == 0);
+    for(int i = 0 ; i < 300 ; i += 3){
+        MED_ASSERT(ed.getItem("k" + std::to_string(i)) == test_ed_data(i, 100 + i * 97 % 5000));
+    }
+    printf("test_EDManager18 >> ok\n");
+}
@@ -1,4 +1,10 @@
 #include "gzip/src/Gzip.h"
+#include "gzip/src/ZlibUtils.h"
+#include "core/src/ByteBufferIO.h"
+#include "core/src/FileUtils.h"
+#include "core/src/common.h"
+#include <fstream>
+#include <atomic>
 
 using namespace h7_gz;
 
@@ -16,12 +22,270 @@ using CTestItem = const TestItem&;
 static void test_Gzip_impl(CTestItem);
 static void test_Gzip11();
 static void test_Gzip12();
+static void test_Gzip21();
+static void test_Gzip22();
+static void test_Gzip23();
+static void test_Gzip24();
+static void test_Gzip25();
 
 void test_Gzip1(){
     //test_Gzip11();
     test_Gzip12();
 }
 
+//round-trip and behavior checks, no input files needed.
+void test_Gzip2(){
+    h7::FileUtils::mkdirs("/tmp/h7_test");
+    test_Gzip21();
+    test_Gzip22();
+    test_Gzip23();
+    test_Gzip24();
+    test_Gzip25();
+}
+
+static String test_content(int i, int len){
+    String s;
+    s.reserve(len);
+    for(int k = 0 ; k < len ; ++k){
+        s.push_back('a' + (k * (i + 1) + k / 7) % 26);
+    }
+    return s;
+}
+
+//extractEntry on groups written by concurrent threads. the first group is much
+//larger, so the later ones are written before it.
+void test_Gzip21(){
+    const String file = "/tmp/h7_test/concurrent.hzip";
+    std::vector<ZipFileItem> items;
+    for(int i = 0 ; i < 20 ; ++i){
+        int len = i < 4 ? (2 << 20) + i : 1000 + i * 37;
+        items.push_back(ZipFileItem::ofMemoryFile("f" + std::to_string(i),
+                                                  test_content(i, len)));
+    }
+    GzipHelper gh;
+    gh.setConcurrentThreadCount(4);
+    gh.setClassifier([](const std::vector<ZipFileItem>& in, std::vector<GroupItem>& out){
+        out.resize(5);
+        for(size_t i = 0 ; i < in.size() ; ++i){
+            int g = i < 4 ? 0 : i % 4 + 1;
+            out[g].name = "grp" + std::to_string(g);
+            out[g].children.push_back(in[i]);
+        }
+    });
+    MED_ASSERT(gh.compressMemoryFiles(items, file));
+    for(auto& it : items){
+        String out;
+        MED_ASSERT(gh.extractEntry(file, it.shortName, out));
+        MED_ASSERT(out == it.content);
+    }
+    String out;
+    MED_ASSERT(!gh.extractEntry(file, "not_exist", out));
+    std::map<String,String> all;
+    MED_ASSERT(gh.decompressFileToMemory(file, all));
+    MED_ASSERT(all.size() == items.size());
+    for(auto& it : items){
+        MED_ASSERT(all[it.shortName] == it.content);
+    }
+    //bytes changed in the entry table(at the end) or the groups: no crash, and a
+    //found entry is the right one unless its own group is changed.
+    const String bad = "/tmp/h7_test/concurrent_bad.hzip";
+    String good = h7::FileUtils::getFileContent(file);
+    std::vector<size_t> poses;
+    for(size_t k = 1 ; k <= 64 ; ++k){
+        poses.push_back(good.length() - k * 16);
+    }
+    for(size_t pos = 0 ; pos < good.length() ; pos += good.length() / 31 + 1){
+        poses.push_back(pos);
+    }
+    for(auto pos : poses){
+        String data = good;
+        for(size_t k = pos ; k < pos + 8 ; ++k){
+            data[k] ^= 0xa5;
+        }
+        MED_ASSERT(h7::FileUtils::writeFile(bad, data));
+        gh.extractEntry(bad, "f5", out);
+        std::vector<ZipEntryInfo> es;
+        gh.listEntries(bad, es);
+    }
+    printf("test_Gzip21 >> ok\n");
+}
+
+//listEntries on the archive of 'test_Gzip21', and on a v1 archive(no entry table)
+//which is listed and extracted by group names.
+void test_Gzip22(){
+    {
+        const String file = "/tmp/h7_test/concurrent.hzip";
+        GzipHelper gh;
+        std::vector<ZipEntryInfo> es;
+        MED_ASSERT(gh.listEntries(file, es));
+        MED_ASSERT(es.size() == 20);
+        //'group' is in file order, which may differ from the classify order.
+        std::map<int, String> groupNames;
+        for(auto& e : es){
+            int i = std::stoi(e.shortName.substr(1));
+            int g = i < 4 ? 0 : i % 4 + 1;
+            MED_ASSERT(e.groupName == "grp" + std::to_string(g));
+            MED_ASSERT(e.group >= 0 && e.group < 5);
+            auto it = groupNames.find(e.group);
+            if(it == groupNames.end()){
+                groupNames[e.group] = e.groupName;
+            }else{
+                MED_ASSERT(it->second == e.groupName);
+            }
+            MED_ASSERT(e.size == (long long)(i < 4 ? (2 << 20) + i : 1000 + i * 37));
+        }
+        MED_ASSERT(groupNames.size() == 5);
+    }
+    const String file = "/tmp/h7_test/v1.hzip";
+    std::vector<String> groupBufs;
+    std::vector<int> nameLens;
+    std::vector<uint64> compLens;
+    for(int g = 0 ; g < 2 ; ++g){
+        GroupItem gi;
+        gi.name = "g" + std::to_string(g);
+        h7::ByteBufferOut bos(1024);
+        bos.putInt(2);
+        for(int k = 0 ; k < 2 ; ++k){
+            int i = g * 2 + k;
+            auto str = test_content(i, 1000 + i);
+            gi.children.push_back(ZipFileItem::ofMemoryFile("v" + std::to_string(i), str));
+            bos.putString64(str);
+        }
+        //simple enc: reversed bytes
+        String buf = bos.bufferToString();
+        std::reverse(buf.begin(), buf.end());
+        groupBufs.push_back(gi.write(buf));
+        nameLens.push_back(2);
+        compLens.push_back(buf.size());
+    }
+    auto header = [&](bool mock){
+        h7::ByteBufferOut bos(256);
+        bos.putString("7NEVAEH");
+        bos.putInt(1);
+        bos.putInt(2);
+        for(int i = 0 ; i < 2 ; ++i) bos.putInt(mock ? 0 : nameLens[i]);
+        for(int i = 0 ; i < 2 ; ++i) bos.putULong(mock ? 0 : compLens[i]);
+        return bos.bufferToString();
+    };
+    {
+        std::ofstream fos(file, std::ios::binary);
+        auto write = [&](const String& s){
+            uint64 len = s.length();
+            fos.write((char*)&len, sizeof(len));
+            fos.write(s.data(), len);
+        };
+        write(header(true));
+        for(auto& s : groupBufs){
+            write(s);
+        }
+        write(header(false));
+    }
+    GzipHelper gh;
+    gh.setUseSimpleEncDec();
+    std::vector<ZipEntryInfo> es;
+    MED_ASSERT(gh.listEntries(file, es));
+    MED_ASSERT(es.size() == 4);
+    for(int i = 0 ; i < 4 ; ++i){
+        MED_ASSERT(es[i].shortName == "v" + std::to_string(i));
+        MED_ASSERT(es[i].group == i / 2);
+        MED_ASSERT(es[i].groupName == "g" + std::to_string(i / 2));
+        MED_ASSERT(es[i].size == -1);
+        String out;
+        MED_ASSERT(gh.extractEntry(file, es[i].shortName, out));
+        MED_ASSERT(out == test_content(i, 1000 + i));
+    }
+    String out;
+    MED_ASSERT(!gh.extractEntry(file, "v9", out));
+    printf("test_Gzip22 >> ok\n");
+}
+
+//parallel deflate: one zlib stream, decoded by the serial inflate.
+void test_Gzip23(){
+    String src;
+    for(int i = 0 ; i < 40 ; ++i){
+        src += test_content(i, 50000);
+    }
+    for(size_t chunk : {(size_t)100000, (size_t)333333, (size_t)1 << 20}){
+        String out;
+        MED_ASSERT(ZlibUtils::compressParallel(src, out, 4, chunk));
+        String back;
+        MED_ASSERT(ZlibUtils::decompress(out, back));
+        MED_ASSERT(back == src);
+    }
+    {
+        String small = "hello", out, back;
+        MED_ASSERT(ZlibUtils::compressParallel(small, out, 4, 2));
+        MED_ASSERT(ZlibUtils::decompress(out, back));
+        MED_ASSERT(back == small);
+    }
+    //through the archive
+    const String file = "/tmp/h7_test/parallel.hzip";
+    std::vector<ZipFileItem> items;
+    for(int i = 0 ; i < 4 ; ++i){
+        items.push_back(ZipFileItem::ofMemoryFile("p" + std::to_string(i),
+                                                  src.substr(i * 300000, 500000)));
+    }
+    GzipHelper gh;
+    gh.setConcurrentThreadCount(4);
+    gh.setParallelDeflateChunkSize(256 << 10);
+    MED_ASSERT(gh.compressMemoryFiles(items, file));
+    std::map<String,String> all;
+    MED_ASSERT(gh.decompressFileToMemory(file, all));
+    for(auto& it : items){
+        MED_ASSERT(all[it.shortName] == it.content);
+    }
+    //one large group among small ones: it is split on the threads the others leave.
+    items.push_back(ZipFileItem::ofMemoryFile("s0", test_content(50, 3000)));
+    items.push_back(ZipFileItem::ofMemoryFile("s1", test_content(51, 5000)));
+    gh.setClassifier([](const std::vector<ZipFileItem>& in, std::vector<GroupItem>& out){
+        out.resize(3);
+        for(auto& zi : in){
+            int g = zi.shortName == "s0" ? 1 : (zi.shortName == "s1" ? 2 : 0);
+            out[g].name = "grp" + std::to_string(g);
+            out[g].children.push_back(zi);
+        }
+    });
+    MED_ASSERT(gh.compressMemoryFiles(items, file));
+    all.clear();
+    MED_ASSERT(gh.decompressFileToMemory(file, all));
+    MED_ASSERT(all.size() == items.size());
+    for(auto& it : items){
+        MED_ASSERT(all[it.shortName] == it.content);
+    }
+    //a custom compressor gets the budget, helpers run on the shared pool.
+    std::atomic<int> maxThreads {0};
+    std::atomic<int> helperRuns {0};
+    gh.setCompressor([&maxThreads, &helperRuns](const std::vector<ZipFileItem>& in,
+                     String* out, const CompressBudget& budget){
+        maxThreads = std::max(maxThreads.load(), budget.threads);
+        h7::ByteBufferOut bos(1 << 20);
+        bos.putInt(in.size());
+        for(auto& zi : in){
+            bos.putString64(zi.readContent());
+        }
+        auto buf = bos.bufferToString();
+        if(buf.length() <= (1 << 20)){
+            return ZlibUtils::compress(buf, *out);
+        }
+        return ZlibUtils::compressParallel(buf, *out, 256 << 10, budget.threads - 1,
+                                           [&budget, &helperRuns](std::function<void()> task){
+            budget.spawn([task, &helperRuns](){
+                ++helperRuns;
+                task();
+            });
+        });
+    });
+    MED_ASSERT(gh.compressMemoryFiles(items, file));
+    MED_ASSERT(maxThreads == 4);
+    MED_ASSERT(helperRuns == 3);
+    all.clear();
+    MED_ASSERT(gh.decompressFileToMemory(file, all));
+    for(auto& it : items){
+        MED_ASSERT(all[it.shortName] == it.content);
+    }
+    printf("test_Gzip23 >> ok\n");
+}
+
 void test_Gzip12(){
     TestItem ti;
     ti.in_dir = "/media/heaven7/Elements_SE/temp/test2";
@@ -80,3 +344,106 @@ void test_Gzip_impl(CTestItem ti){
     printf("decompressFile: %s,in_dir = '%s', outF = '%s'\n",
            decStr.data(), in_dir.data(), out_file.data());
 }
+
+//decompress with many more groups than the read-ahead slots, to memory and to a dir.
+//a corrupt group fails the whole file without blocking the reader.
+void test_Gzip24(){
+    const String file = "/tmp/h7_test/groups.hzip";
+    const String outDir = "/tmp/h7_test/groups_out";
+    std::vector<ZipFileItem> items;
+    for(int i = 0 ; i < 120 ; ++i){
+        items.push_back(ZipFileItem::ofMemoryFile("g" + std::to_string(i),
+                                                  test_content(i, 20000 + i * 977)));
+    }
+    //one group per item.
+    auto classify = [](const std::vector<ZipFileItem>& in, std::vector<GroupItem>& out){
+        out.resize(in.size());
+        for(size_t i = 0 ; i < in.size() ; ++i){
+            out[i].name = in[i].shortName;
+            out[i].children.push_back(in[i]);
+        }
+    };
+    h7::FileUtils::mkdirs(outDir);
+    for(int tc : {1, 4}){
+        GzipHelper gh;
+        gh.setConcurrentThreadCount(tc);
+        gh.setClassifier(classify);
+        MED_ASSERT(gh.compressMemoryFiles(items, file));
+        std::map<String,String> all;
+        MED_ASSERT(gh.decompressFileToMemory(file, all));
+        MED_ASSERT(all.size() == items.size());
+        for(auto& it : items){
+            MED_ASSERT(all[it.shortName] == it.content);
+        }
+        MED_ASSERT(gh.decompressFile(file, outDir));
+        for(auto& it : items){
+            MED_ASSERT(h7::FileUtils::getFileContent(outDir + "/" + it.shortName) == it.content);
+        }
+    }
+    String data = h7::FileUtils::getFileContent(file);
+    for(int k = 0 ; k < 64 ; ++k){
+        data[data.length() / 2 + k] ^= 0x5a;
+    }
+    const String bad = "/tmp/h7_test/groups_bad.hzip";
+    MED_ASSERT(h7::FileUtils::writeFile(bad, data));
+    for(int tc : {1, 4}){
+        GzipHelper gh;
+        gh.setConcurrentThreadCount(tc);
+        std::map<String,String> all;
+        MED_ASSERT(!gh.decompressFileToMemory(bad, all));
+    }
+    //bytes changed anywhere, group lengths and names too: no crash, no hang.
+    GzipHelper gh;
+    gh.setConcurrentThreadCount(4);
+    String good = h7::FileUtils::getFileContent(file);
+    for(size_t pos = 0 ; pos < good.length() ; pos += good.length() / 97 + 1){
+        data = good;
+        for(size_t k = pos ; k < pos + 8 && k < data.length() ; ++k){
+            data[k] ^= 0xa5;
+        }
+        MED_ASSERT(h7::FileUtils::writeFile(bad, data));
+        std::map<String,String> all;
+        gh.decompressFileToMemory(bad, all);
+    }
+    printf("test_Gzip24 >> ok\n");
+}
+
+//compressDir streams the files from disk by chunks: empty, small and multi chunk files
+//round-trip. a file which can't be read fails the compress.
+void test_Gzip25(){
+    const String dir = "/tmp/h7_test/gz_src";
+    const String file = "/tmp/h7_test/gz_src.hzip";
+    h7::FileUtils::mkdirs(dir + "/sub");
+    std::map<String, String> contents;
+    for(int i = 0 ; i < 12 ; ++i){
+        String shortName = String(i % 2 ? "sub/" : "") + "f" + std::to_string(i) + ".bin";
+        int len = i == 0 ? 0 : (i == 5 ? (3 << 20) + 7 : 100 + i * 3001);
+        contents[shortName] = test_content(i, len);
+        MED_ASSERT(h7::FileUtils::writeFile(dir + "/" + shortName, contents[shortName]));
+    }
+    for(int tc : {1, 4}){
+        GzipHelper gh;
+        gh.setConcurrentThreadCount(tc);
+        MED_ASSERT(gh.compressDir(dir, file));
+        std::map<String,String> all;
+        MED_ASSERT(gh.decompressFileToMemory(file, all));
+        MED_ASSERT(all == contents);
+        String out;
+        MED_ASSERT(gh.extractEntry(file, "sub/f5.bin", out));
+        MED_ASSERT(out == contents["sub/f5.bin"]);
+    }
+    //a missing file, with memory items in the same group.
+    std::vector<ZipFileItem> items;
+    items.push_back(ZipFileItem::ofMemoryFile("m0", test_content(0, 1000)));
+    ZipFileItem missing;
+    missing.name = dir + "/missing.bin";
+    missing.shortName = "missing.bin";
+    missing.contentLen = 10;
+    items.push_back(missing);
+    for(int tc : {1, 4}){
+        GzipHelper gh;
+        gh.setConcurrentThreadCount(tc);
+        MED_ASSERT(!gh.compressMemoryFiles(items, "/tmp/h7_test/gz_missing.hzip"));
+    }
+    printf("test_Gzip25 >> ok\n");
+}
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <string.h>
 #include <memory>
+#include <condition_variable>
 #include "Gzip.h"
 #include "core/src/FileUtils.h"
 #include "core/src/ByteBufferIO.h"
@@ -12,6 +15,8 @@
 
 #define DEFAUL_HASH_LEN (4 << 20) //4M
 #define DEFAUL_HASH_SEED 17
+#define DEFAUL_STREAM_CHUNK (1 << 20) //1M
+#define DEFAUL_READ_AHEAD_PER_THREAD 2 //groups read ahead per decompress thread
 
 namespace h7_gz {
 
@@ -26,6 +31,7 @@ static inline bool _contains0(const std::vector<String>& vec, CString str){
 
 using FUNC_Classify = GzipHelper::FUNC_Classify;
 using FUNC_Compressor = GzipHelper::FUNC_Compressor;
+using FUNC_ParallelCompressor = GzipHelper::FUNC_ParallelCompressor;
 using FUNC_DeCompressor = GzipHelper::FUNC_DeCompressor;
 
 String ZipFileItem::readContent()const{
@@ -62,14 +68,41 @@ String GroupItem::write(CString buffer) const{
 
 bool GroupItem::read(String& bufIn, String& bufOut){
     h7::ByteBufferIO bis(&bufIn);
+    //a corrupt group fails here: every length is checked against the bytes left.
+    auto readStr16 = [&bis](String& out){
+        if(bis.getLeftLength() < sizeof(unsigned short)){
+            return false;
+        }
+        auto len = bis.getUShort();
+        if(len > bis.getLeftLength()){
+            return false;
+        }
+        out = bis.getRawString(len);
+        return true;
+    };
+    if(bis.getLeftLength() < sizeof(int)){
+        return false;
+    }
     int childrenCnt = bis.getInt();
+    //every name has a 2 bytes length at least.
+    if(childrenCnt < 0 || (uint64)childrenCnt * 2 > bis.getLeftLength()){
+        return false;
+    }
     children.resize(childrenCnt);
     for(ZipFileItem& zi : children){
-        zi.shortName = bis.getString16();
+        if(!readStr16(zi.shortName)){
+            return false;
+        }
+    }
+    if(!readStr16(this->name) || bis.getLeftLength() < sizeof(uint64) * 2){
+        return false;
     }
-    this->name = bis.getString16();
     auto hash = bis.getULong();
-    bufOut = bis.getString64();
+    auto len = bis.getULong();
+    if(len > bis.getLeftLength()){
+        return false;
+    }
+    bufOut = bis.getRawString(len);
 
     size_t hash_len = bufOut.size() > DEFAUL_HASH_LEN ? DEFAUL_HASH_LEN : bufOut.size();
     uint64 hval = fasthash64(bufOut.data(), hash_len, DEFAUL_HASH_SEED);
@@ -93,6 +126,99 @@ GroupItem GroupItem::filter(CString ext, bool remove){
     return ret;
 }
 
+//stream the default group layout: int count, then (uint64 len + content)
+//per item. file content is read by chunk, never held as a whole.
+struct GroupZlibInput0: public IZlibInput{
+    const std::vector<ZipFileItem>& items;
+    String pending;         //count or length prefix, not emitted yet.
+    size_t pendingPos {0};
+    const ZipFileItem* cur {nullptr};
+    std::ifstream fis;
+    uint64 left {0};        //content bytes left of 'cur'
+    size_t index {0};
+    bool finished {false};
+    bool failed {false};
+
+    GroupZlibInput0(const std::vector<ZipFileItem>& items):items(items){
+        int cnt = items.size();
+        pending.append((char*)&cnt, sizeof(int));
+    }
+    bool hasNext() override{
+        return !finished;
+    }
+    size_t next(std::vector<char>& vec, bool& isFinish) override{
+        //keep the capacity, zlib sizes its out buffer by it.
+        vec.resize(DEFAUL_STREAM_CHUNK);
+        size_t len = 0;
+        while(len < vec.size() && !finished){
+            if(pendingPos < pending.size()){
+                size_t n = std::min(pending.size() - pendingPos, vec.size() - len);
+                memcpy(vec.data() + len, pending.data() + pendingPos, n);
+                pendingPos += n;
+                len += n;
+            }else if(left > 0){
+                size_t n = std::min((size_t)left, vec.size() - len);
+                if(!readContent0(vec.data() + len, n)){
+                    failed = true;
+                    finished = true;
+                    break;
+                }
+                left -= n;
+                len += n;
+            }else if(index < items.size()){
+                if(!openItem0(items[index++])){
+                    failed = true;
+                    finished = true;
+                }
+            }else{
+                finished = true;
+            }
+        }
+        isFinish = finished;
+        return len;
+    }
+
+private:
+    bool openItem0(const ZipFileItem& zi){
+        cur = &zi;
+        if(fis.is_open()){
+            fis.close();
+        }
+        uint64 len = zi.content.length();
+        if(zi.content.empty() && !zi.name.empty()){
+            fis.open(zi.name, std::ios::binary);
+            if(!fis.is_open()){
+                fprintf(stderr, "open file failed. %s\n", zi.name.data());
+                return false;
+            }
+            len = h7::FileUtils::getFileSize(zi.name);
+        }
+        pending.assign((char*)&len, sizeof(uint64));
+        pendingPos = 0;
+        left = len;
+        return true;
+    }
+    bool readContent0(char* dst, size_t n){
+        if(fis.is_open()){
+            fis.read(dst, n);
+            return !fis.fail();
+        }
+        size_t pos = cur->content.length() - left;
+        memcpy(dst, cur->content.data() + pos, n);
+        return true;
+    }
+};
+
+struct StringZlibOutput0: public IZlibOutput{
+    String* out;
+    StringZlibOutput0(String* out):out(out){}
+
+    bool write(std::vector<char>& buf, size_t len) override{
+        out->append(buf.data(), len);
+        return true;
+    }
+};
+
 struct GroupItemTask{
     int index;
     GroupItem* gi;
@@ -184,12 +310,28 @@ std::shared_ptr<IRandomWriter> IRandomWriter::NewFileWriter(CString filePath){
     return std::make_shared<FileWriter0>(filePath);
 }
 
+//v2: one entry per file, to locate it without scanning groups.
+struct ZipEntry0{
+    String shortName;
+    int group {0};      //group index in file order
+    int index {0};      //index in group
+    uint64 size {0};    //content length
+};
+
 struct ZipHeader0{
     String magic {"7NEVAEH"};
-    int version {1};
+    int version {3};
     int groupCount {0};
     std::vector<int> nameLens;
-    std::vector<size_t> compressedLens;   
+    std::vector<size_t> compressedLens;
+    //v2
+    std::vector<uint64> groupOffsets; //file pos of group's length prefix.
+    std::vector<ZipEntry0> entries;
+    //v3
+    std::vector<String> groupNames;   //in file order
+    //compress only, not serialized.
+    uint64 writePos {0};
+    std::vector<int> writeOrder;
 
     String str(bool mock)const{
         h7::ByteBufferOut bos(4096);
@@ -213,22 +355,108 @@ struct ZipHeader0{
                 bos.putULong(compressedLens[i]);
             }
         }
+        if(version >= 2){
+            for(int i = 0 ; i < groupCount; ++i){
+                bos.putULong(mock ? 0 : groupOffsets[i]);
+            }
+            //names are known before write, so mock has the same size.
+            bos.putInt(entries.size());
+            for(auto& e : entries){
+                bos.putString16(e.shortName);
+                bos.putInt(e.group);
+                bos.putInt(e.index);
+                bos.putULong(e.size);
+            }
+        }
+        if(version >= 3){
+            MED_ASSERT((int)groupNames.size() == groupCount);
+            for(auto& name : groupNames){
+                bos.putString16(name);
+            }
+        }
         return bos.bufferToString();
     }
 
-    void parse(String& buf){
+    //false if a count or length is past the buffer(a corrupt trailer).
+    bool parse(String& buf){
         nameLens.clear();
         compressedLens.clear();
+        groupOffsets.clear();
+        entries.clear();
+        groupNames.clear();
         h7::ByteBufferIO bio(&buf);
-        magic = bio.getString();
+        auto has = [&bio](uint64 len){
+            return bio.getLeftLength() >= len;
+        };
+        auto getStr16 = [&bio, &has](String& out){
+            if(!has(sizeof(unsigned short))){
+                return false;
+            }
+            auto len = bio.getUShort();
+            if(!has(len)){
+                return false;
+            }
+            out = bio.getRawString(len);
+            return true;
+        };
+        if(!has(sizeof(unsigned int))){
+            return false;
+        }
+        auto magicLen = bio.getUInt();
+        if(!has((uint64)magicLen + sizeof(int) * 2)){
+            return false;
+        }
+        magic = bio.getRawString(magicLen);
         version = bio.getInt();
         groupCount = bio.getInt();
+        if(groupCount < 0 || !has((uint64)groupCount * (sizeof(int) + sizeof(uint64)))){
+            return false;
+        }
         for(int i = 0 ; i < groupCount; ++i){
             nameLens.push_back(bio.getInt());
         }
         for(int i = 0 ; i < groupCount; ++i){
             compressedLens.push_back(bio.getULong());
         }
+        if(version >= 2){
+            if(!has((uint64)groupCount * sizeof(uint64) + sizeof(int))){
+                return false;
+            }
+            for(int i = 0 ; i < groupCount; ++i){
+                groupOffsets.push_back(bio.getULong());
+            }
+            int entryCnt = bio.getInt();
+            //every entry has 2 + 4 + 4 + 8 bytes at least.
+            if(entryCnt < 0 || !has((uint64)entryCnt * 18)){
+                return false;
+            }
+            entries.resize(entryCnt);
+            for(auto& e : entries){
+                if(!getStr16(e.shortName) || !has(sizeof(int) * 2 + sizeof(uint64))){
+                    return false;
+                }
+                e.group = bio.getInt();
+                e.index = bio.getInt();
+                e.size = bio.getULong();
+            }
+        }
+        if(version >= 3){
+            groupNames.resize(groupCount);
+            for(auto& name : groupNames){
+                if(!getStr16(name)){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    const ZipEntry0* findEntry(CString shortName)const{
+        for(auto& e : entries){
+            if(e.shortName == shortName){
+                return &e;
+            }
+        }
+        return nullptr;
     }
 };
 
@@ -238,9 +466,10 @@ struct GzipHelper_Ctx0{
     std::vector<String> incDirs;
     std::vector<String> excDirs;
     FUNC_Classify func_classify;
-    FUNC_Compressor func_compressor;
+    FUNC_ParallelCompressor func_compressor;
     FUNC_DeCompressor func_deCompressor;
     int concurrentCnt {1};
+    size_t deflateChunkSize {0}; //>0: deflate a large group in parallel chunks
     bool debug_ {false};
 
     bool compressDir(CString dir, CString outFile){
@@ -308,44 +537,19 @@ struct GzipHelper_Ctx0{
             return false;
         }
         size_t contentPos = 0;
-        size_t contentLen = 0;
         ZipHeader0 header;
-        //read head
-        {
-            size_t headerSize = 0;
-            fis.read((char*)&headerSize, sizeof(size_t));
-            if(fis.fail() || headerSize == 0){
-                return false;
-            }
-            contentPos = headerSize + sizeof (size_t);
-            contentLen = fileTotalLen - contentPos * 2;
-            //
-            size_t headerActPos = contentPos + contentLen + sizeof(size_t);
-            fis.seekg(headerActPos, std::ios::beg);
-            if(fis.fail()){
-                return false;
-            }
-            //
-            String headBuf;
-            headBuf.resize(headerSize);
-            fis.read((char*)headBuf.data(), headerSize);
-            if(fis.fail()){
-                return false;
-            }
-            header.parse(headBuf);
-            if((int)header.compressedLens.size() != header.groupCount){
-                return false;
-            }
-            if((int)header.nameLens.size() != header.groupCount){
-                return false;
-            }
-            fis.seekg(contentPos, std::ios::beg);
-            if(fis.fail()){
-                return false;
-            }
+        if(!readHeader0(fis, fileTotalLen, header, contentPos)){
+            return false;
         }
         //read body.
         std::vector<std::shared_ptr<GroupItemState>> gitems;
+        //bounded read-ahead: the reader waits until a group is decoded,
+        //so at most 'maxInFlight' blobs are held in memory.
+        const int maxInFlight = (concurrentCnt > 1 ? concurrentCnt : 1)
+                * DEFAUL_READ_AHEAD_PER_THREAD;
+        int inFlight = 0;
+        std::mutex flightMtx;
+        std::condition_variable flightCv;
         {
             h7::ThreadPool pool(concurrentCnt);
             for(int ni = 0; ni < (int)header.compressedLens.size(); ++ ni){
@@ -354,6 +558,17 @@ struct GzipHelper_Ctx0{
                 if(fis.fail()){
                     break;
                 }
+                //a corrupt length must not allocate past the file.
+                if(blockSize > fileTotalLen - (size_t)fis.tellg()){
+                    return false;
+                }
+                {
+                    std::unique_lock<std::mutex> lck(flightMtx);
+                    flightCv.wait(lck, [&inFlight, maxInFlight](){
+                        return inFlight < maxInFlight;
+                    });
+                    ++inFlight;
+                }
                 auto bufPtr = std::shared_ptr<String>(new String());
                 bufPtr->resize(blockSize);
                 fis.read((char*)bufPtr->data(), blockSize);
@@ -362,42 +577,15 @@ struct GzipHelper_Ctx0{
                 }
                 auto gs = std::make_shared<GroupItemState>();
                 gitems.push_back(gs);
-                pool.enqueue([this, decM, bufPtr, gs](){
-                    std::vector<String> datas;
+                pool.enqueue([this, decM, bufPtr, gs,
+                             &inFlight, &flightMtx, &flightCv](){
+                    decodeGroup0(decM, *bufPtr, gs.get());
+                    String().swap(*bufPtr);
                     {
-                        String bufOut;
-                        gs->gi.read(*bufPtr, bufOut);
-                        if(!func_deCompressor(bufOut, datas)){
-                            gs->state = false;
-                            return;
-                        }
-                        gs->bufLen = bufOut.size();
-                        if(gs->gi.children.size() != datas.size()){
-                            gs->state = false;
-                            return;
-                        }
-                        gs->state = true;
-                    }
-                    for(int i = 0 ; i < (int)datas.size() ; ++i){
-                        auto& shortName = gs->gi.children[i].shortName;
-                        auto writer0 = decM->getWriter(shortName);
-                        if(writer0->open()){
-                            auto& dat = datas[i];
-                            writer0->write(dat.data(), dat.size());
-                            writer0->close();
-                        }else{
-                            fprintf(stderr, "write file failed. %s\n", shortName.data());
-                        }
-                    }
-                    if(debug_){
-                        for(int i = 0 ; i < (int)datas.size() ; ++i){
-                             auto& zi = gs->gi.children[i];
-                             auto& cs = datas[i];
-                             auto hash = fasthash64(cs.data(), cs.length(), DEFAUL_HASH_SEED);
-                             auto hashStr = std::to_string(hash);
-                             printf("[ DeCompress ] %s: hash = %s\n", zi.shortName.data(), hashStr.data());
-                        }
+                        std::unique_lock<std::mutex> lck(flightMtx);
+                        --inFlight;
                     }
+                    flightCv.notify_one();
                 });
             }
         }
@@ -418,8 +606,290 @@ struct GzipHelper_Ctx0{
         }
         return true;
     }
+    bool extractEntry(CString file, CString shortName, String& out){
+        const auto fileTotalLen = h7::FileUtils::getFileSize(file);
+        if(fileTotalLen == 0){
+            fprintf(stderr, "file is empty: %s\n", file.data());
+            return false;
+        }
+        std::ifstream fis;
+        fis.open(file, std::ios::binary);
+        if(!fis.is_open()){
+            return false;
+        }
+        size_t contentPos = 0;
+        ZipHeader0 header;
+        if(!readHeader0(fis, fileTotalLen, header, contentPos)){
+            return false;
+        }
+        String blob;
+        int index = -1;
+        if(header.version >= 2){
+            auto e = header.findEntry(shortName);
+            if(e == nullptr || e->group < 0 || e->group >= header.groupCount
+                    || e->index < 0){
+                return false;
+            }
+            fis.seekg(header.groupOffsets[e->group], std::ios::beg);
+            if(!readBlock0(fis, fileTotalLen, blob)){
+                return false;
+            }
+            index = e->index;
+        }else{
+            //v1 has no index: only read the name prefix of each group.
+            fis.seekg(contentPos, std::ios::beg);
+            for(int gi = 0 ; gi < header.groupCount && index < 0 ; ++gi){
+                size_t blockSize = 0;
+                size_t consumed = 0;
+                std::vector<String> names;
+                if(!readGroupNames0(fis, blockSize, consumed, names)){
+                    return false;
+                }
+                for(int i = 0 ; i < (int)names.size() ; ++i){
+                    if(names[i] == shortName){
+                        index = i;
+                        break;
+                    }
+                }
+                if(index >= 0){
+                    fis.seekg(-(std::streamoff)consumed, std::ios::cur);
+                    if(blockSize > fileTotalLen - (size_t)fis.tellg()){
+                        return false;
+                    }
+                    blob.resize(blockSize);
+                    fis.read((char*)blob.data(), blockSize);
+                }else{
+                    fis.seekg(blockSize - consumed, std::ios::cur);
+                }
+                if(fis.fail()){
+                    return false;
+                }
+            }
+            if(index < 0){
+                return false;
+            }
+        }
+        GroupItem gitem;
+        String bufOut;
+        if(!gitem.read(blob, bufOut)){
+            return false;
+        }
+        std::vector<String> datas;
+        if(!func_deCompressor(bufOut, datas)){
+            return false;
+        }
+        if(gitem.children.size() != datas.size() || index < 0
+                || index >= (int)datas.size()){
+            return false;
+        }
+        if(gitem.children[index].shortName != shortName){
+            return false;
+        }
+        out = std::move(datas[index]);
+        return true;
+    }
+    bool listEntries(CString file, std::vector<ZipEntryInfo>& out){
+        const auto fileTotalLen = h7::FileUtils::getFileSize(file);
+        if(fileTotalLen == 0){
+            fprintf(stderr, "file is empty: %s\n", file.data());
+            return false;
+        }
+        std::ifstream fis;
+        fis.open(file, std::ios::binary);
+        if(!fis.is_open()){
+            return false;
+        }
+        size_t contentPos = 0;
+        ZipHeader0 header;
+        if(!readHeader0(fis, fileTotalLen, header, contentPos)){
+            return false;
+        }
+        out.clear();
+        if(header.version >= 2){
+            out.reserve(header.entries.size());
+            for(auto& e : header.entries){
+                if(e.group < 0 || e.group >= header.groupCount){
+                    return false;
+                }
+                ZipEntryInfo info;
+                info.shortName = e.shortName;
+                info.group = e.group;
+                info.size = e.size;
+                if(header.version >= 3){
+                    info.groupName = header.groupNames[e.group];
+                }
+                out.push_back(std::move(info));
+            }
+            return true;
+        }
+        //v1: names from the prefix of each group, sizes are unknown.
+        for(int gi = 0 ; gi < header.groupCount ; ++gi){
+            size_t blockSize = 0;
+            size_t consumed = 0;
+            std::vector<String> names;
+            String groupName;
+            if(!readGroupNames0(fis, blockSize, consumed, names, &groupName)){
+                return false;
+            }
+            for(auto& name : names){
+                ZipEntryInfo info;
+                info.shortName = std::move(name);
+                info.groupName = groupName;
+                info.group = gi;
+                out.push_back(std::move(info));
+            }
+            fis.seekg(blockSize - consumed, std::ios::cur);
+            if(fis.fail()){
+                return false;
+            }
+        }
+        return true;
+    }
 
 private:
+    void decodeGroup0(IDecompressManager* decM, String& buf, GroupItemState* gs){
+        std::vector<String> datas;
+        {
+            String bufOut;
+            if(!gs->gi.read(buf, bufOut) || !func_deCompressor(bufOut, datas)){
+                gs->state = false;
+                return;
+            }
+            gs->bufLen = bufOut.size();
+            if(gs->gi.children.size() != datas.size()){
+                gs->state = false;
+                return;
+            }
+            gs->state = true;
+        }
+        for(int i = 0 ; i < (int)datas.size() ; ++i){
+            auto& shortName = gs->gi.children[i].shortName;
+            auto writer0 = decM->getWriter(shortName);
+            if(writer0->open()){
+                auto& dat = datas[i];
+                writer0->write(dat.data(), dat.size());
+                writer0->close();
+            }else{
+                fprintf(stderr, "write file failed. %s\n", shortName.data());
+            }
+        }
+        if(debug_){
+            for(int i = 0 ; i < (int)datas.size() ; ++i){
+                 auto& zi = gs->gi.children[i];
+                 auto& cs = datas[i];
+                 auto hash = fasthash64(cs.data(), cs.length(), DEFAUL_HASH_SEED);
+                 auto hashStr = std::to_string(hash);
+                 printf("[ DeCompress ] %s: hash = %s\n", zi.shortName.data(), hashStr.data());
+            }
+        }
+    }
+    //read the trailer header, then 'contentPos' is the pos of first group.
+    bool readHeader0(std::ifstream& fis, size_t fileTotalLen,
+                     ZipHeader0& header, size_t& contentPos){
+        size_t headerSize = 0;
+        fis.read((char*)&headerSize, sizeof(size_t));
+        if(fis.fail() || headerSize == 0){
+            return false;
+        }
+        contentPos = headerSize + sizeof (size_t);
+        if(fileTotalLen < contentPos * 2){
+            return false;
+        }
+        size_t contentLen = fileTotalLen - contentPos * 2;
+        //
+        size_t headerActPos = contentPos + contentLen + sizeof(size_t);
+        fis.seekg(headerActPos, std::ios::beg);
+        if(fis.fail()){
+            return false;
+        }
+        //
+        String headBuf;
+        headBuf.resize(headerSize);
+        fis.read((char*)headBuf.data(), headerSize);
+        if(fis.fail()){
+            return false;
+        }
+        if(!header.parse(headBuf)){
+            return false;
+        }
+        if((int)header.compressedLens.size() != header.groupCount){
+            return false;
+        }
+        if((int)header.nameLens.size() != header.groupCount){
+            return false;
+        }
+        if(header.version >= 2 &&
+                (int)header.groupOffsets.size() != header.groupCount){
+            return false;
+        }
+        if(header.version >= 3 &&
+                (int)header.groupNames.size() != header.groupCount){
+            return false;
+        }
+        fis.seekg(contentPos, std::ios::beg);
+        return !fis.fail();
+    }
+    //'fileTotalLen': a corrupt length must not allocate past the file.
+    bool readBlock0(std::ifstream& fis, size_t fileTotalLen, String& out){
+        size_t blockSize = 0;
+        fis.read((char*)&blockSize, sizeof(size_t));
+        if(fis.fail() || blockSize > fileTotalLen - (size_t)fis.tellg()){
+            return false;
+        }
+        out.resize(blockSize);
+        fis.read((char*)out.data(), blockSize);
+        return !fis.fail();
+    }
+    //read children names of the group at current pos, without the content.
+    //'consumed': bytes read after the length prefix.
+    bool readGroupNames0(std::ifstream& fis, size_t& blockSize,
+                         size_t& consumed, std::vector<String>& names,
+                         String* groupName = nullptr){
+        fis.read((char*)&blockSize, sizeof(size_t));
+        if(fis.fail()){
+            return false;
+        }
+        size_t left = blockSize;
+        int childrenCnt = 0;
+        if(left < sizeof(int)){
+            return false;
+        }
+        fis.read((char*)&childrenCnt, sizeof(int));
+        left -= sizeof(int);
+        auto readStr16 = [&fis, &left](String& str){
+            unsigned short len = 0;
+            if(left < sizeof(len)){
+                return false;
+            }
+            fis.read((char*)&len, sizeof(len));
+            left -= sizeof(len);
+            if(left < len){
+                return false;
+            }
+            str.resize(len);
+            fis.read((char*)str.data(), len);
+            left -= len;
+            return true;
+        };
+        //every name has a 2 bytes length at least.
+        if(fis.fail() || childrenCnt < 0 || (uint64)childrenCnt * 2 > left){
+            return false;
+        }
+        names.resize(childrenCnt);
+        for(auto& name : names){
+            if(!readStr16(name)){
+                return false;
+            }
+        }
+        if(groupName && !readStr16(*groupName)){
+            return false;
+        }
+        if(fis.fail()){
+            return false;
+        }
+        consumed = blockSize - left;
+        return true;
+    }
     bool compressDir0(CString dir, IRandomWriter* rw){
         std::vector<String> vec;
         std::vector<String> exts;
@@ -551,29 +1021,67 @@ private:
         //compress
         ZipHeader0 header;
         header.groupCount = gitems.size();
+        for(int i = 0 ; i < (int)gitems.size() ; ++i){
+            header.groupNames.push_back(gitems[i].name);
+            auto& children = gitems[i].children;
+            for(int k = 0 ; k < (int)children.size() ; ++k){
+                ZipEntry0 e;
+                e.shortName = children[k].shortName;
+                e.group = i; //remapped to file order after write.
+                e.index = k;
+                e.size = children[k].contentLen;
+                header.entries.push_back(std::move(e));
+            }
+        }
         if(!writer->open()){
             return false;
         }
-        if(!writer->write(header.str(true))){
-            return false;
+        {
+            auto hstr = header.str(true);
+            if(!writer->write(hstr)){
+                return false;
+            }
+            header.writePos = sizeof(size_t) + hstr.size();
         }
         if(concurrentCnt > 1){
+            //groups and the chunks of a large group share one pool. every group
+            //gets the whole budget, its chunk tasks queue behind the groups and
+            //take the threads the groups leave free.
+            h7::ThreadPool pool(concurrentCnt);
+            CompressBudget budget;
+            budget.threads = concurrentCnt;
+            budget.spawn = [&pool](std::function<void()> task){
+                pool.enqueue(std::move(task));
+            };
             using SpGITask = std::shared_ptr<GroupItemTask>;
             auto writer0 = writer;
             std::vector<int> writeRets(gitems.size(), 1);
-            h7::ConcurrentWorker<SpGITask> worker(gitems.size(),
+            //the queue needs at least 2 cells.
+            h7::ConcurrentWorker<SpGITask> worker(std::max<int>(2, gitems.size()),
                                                 [this, writer0, &header, &writeRets](SpGITask& st){
-                 writeRets[st->index] = doWrite(writer0, header, st->gi, st->cmpBuffer);
+                 writeRets[st->index] = doWrite(writer0, header, st->index,
+                                                st->gi, st->cmpBuffer);
             });
             worker.start();
-            //multi threads compress.
-            //write to a temp file. then merge?. NO IO may be too lot.
-            int ret = h7::ThreadPool::batchRawRun(concurrentCnt, 0, gitems.size(),
-                                                      [this, &gitems, &worker](int i){
-                    auto& children = gitems[i].children;
-                    //auto& key = gitems[i].name;
+            //the largest groups first, they are the ones worth splitting.
+            std::vector<std::pair<uint64,int>> order;
+            for(int i = 0 ; i < (int)gitems.size() ; ++i){
+                uint64 size = 0;
+                for(auto& zi : gitems[i].children){
+                    size += zi.contentLen;
+                }
+                order.emplace_back(size, i);
+            }
+            std::stable_sort(order.begin(), order.end(),
+                             [](const std::pair<uint64,int>& a, const std::pair<uint64,int>& b){
+                return a.first > b.first;
+            });
+            std::vector<std::future<bool>> rets;
+            for(auto& o : order){
+                const int i = o.second;
+                rets.push_back(pool.enqueue([this, i, &gitems, &worker, &budget](){
                     String buffer;
-                    if(!func_compressor(children, &buffer)){
+                    if(!func_compressor(gitems[i].children, &buffer, budget)){
                         return false;
                     }
                     if(buffer.empty()){
@@ -581,10 +1089,15 @@ private:
                     }
                     worker.addTask(std::make_shared<GroupItemTask>(i, &gitems[i], std::move(buffer)));
                     return true;
-                });
+                }));
+            }
+            bool ok = true;
+            for(auto& r : rets){
+                ok = r.get() && ok;
+            }
             //stop write worker
             worker.stop();
-            if(ret == 0){
+            if(!ok){
                 return false;
             }
             MED_ASSERT(writeRets.size() == gitems.size());
@@ -594,22 +1107,36 @@ private:
                 }
             }
         }else{
+            CompressBudget budget;
             for(auto it = gitems.begin(); it != gitems.end(); ++it){
                 auto& children = it->children;
                 //auto& key = it->name;
                 //
                 String buffer;
-                func_compressor(children, &buffer);
+                if(!func_compressor(children, &buffer, budget)){
+                    return false;
+                }
                 if(buffer.empty()){
                     return false;
                 }
                 auto& gitem = *it;
-                if(!doWrite(writer, header, &gitem, buffer)){
+                if(!doWrite(writer, header, it - gitems.begin(), &gitem, buffer)){
                     return false;
                 }
             }
         }
         {
+            //groups may be written out of order by the concurrent worker.
+            std::vector<int> fileIdx(gitems.size(), -1);
+            for(int i = 0 ; i < (int)header.writeOrder.size() ; ++i){
+                fileIdx[header.writeOrder[i]] = i;
+            }
+            for(auto& e : header.entries){
+                e.group = fileIdx[e.group];
+            }
+            for(int i = 0 ; i < (int)header.writeOrder.size() ; ++i){
+                header.groupNames[i] = gitems[header.writeOrder[i]].name;
+            }
             auto hstr = header.str(false);
             //printf("write header: %s\n", hstr.data());
             if(!writer->write(hstr)){
@@ -619,7 +1146,7 @@ private:
         writer->close();
         return true;
     }
-    bool doWrite(IRandomWriter* writer, ZipHeader0& header,
+    bool doWrite(IRandomWriter* writer, ZipHeader0& header, int index,
                  GroupItem* gi, CString buffer){
         String data = gi->write(buffer);
         {
@@ -629,6 +1156,9 @@ private:
             }
             header.nameLens.push_back(gi->name.size());
             header.compressedLens.push_back(buffer.size());
+            header.groupOffsets.push_back(header.writePos);
+            header.writeOrder.push_back(index);
+            header.writePos += sizeof(size_t) + data.size();
         }
         return true;
     }
@@ -640,12 +1170,25 @@ private:
 
 GzipHelper::GzipHelper(){
     m_ptr = new GzipHelper_Ctx0();
-    setCompressor([](const std::vector<ZipFileItem>& items, String* out){
+    auto ctx = m_ptr;
+    setCompressor([ctx](const std::vector<ZipFileItem>& items, String* out,
+                        const CompressBudget& budget){
         unsigned long long mayTotalSize = sizeof(int);
         for(auto& zi : items){
             mayTotalSize += zi.contentLen;
             mayTotalSize += sizeof(unsigned long long);
         }
+        const size_t chunkSize = ctx->deflateChunkSize;
+        if(chunkSize == 0 || budget.threads <= 1 || mayTotalSize <= chunkSize){
+            //stream from disk into deflate.
+            GroupZlibInput0 in(items);
+            StringZlibOutput0 os(out);
+            if(!ZlibUtils::compress(&in, &os)){
+                return false;
+            }
+            return !in.failed;
+        }
+        //parallel deflate needs the whole buffer.
         h7::ByteBufferOut bos(mayTotalSize);
         bos.putInt(items.size());
         for(auto& zi : items){
@@ -653,7 +1196,8 @@ GzipHelper::GzipHelper(){
             bos.putString64(cs);
         }
         auto buffer = bos.bufferToString();
-        return ZlibUtils::compress(buffer, *out);
+        return ZlibUtils::compressParallel(buffer, *out, chunkSize,
+                                           budget.threads - 1, budget.spawn);
     });
     setDeCompressor([](String& _str,std::vector<String>& vecOut){
         String str;
@@ -707,6 +1251,12 @@ void GzipHelper::setClassifier(FUNC_Classify func){
     m_ptr->func_classify = func;
 }
 void GzipHelper::setCompressor(FUNC_Compressor func){
+    m_ptr->func_compressor = [func](const std::vector<ZipFileItem>& items, String* out,
+                                    const CompressBudget&){
+        return func(items, out);
+    };
+}
+void GzipHelper::setCompressor(FUNC_ParallelCompressor func){
     m_ptr->func_compressor = func;
 }
 void GzipHelper::setDeCompressor(FUNC_DeCompressor func){
@@ -715,6 +1265,9 @@ void GzipHelper::setDeCompressor(FUNC_DeCompressor func){
 void GzipHelper::setConcurrentThreadCount(int count){
     m_ptr->concurrentCnt = count;
 }
+void GzipHelper::setParallelDeflateChunkSize(size_t chunkSize){
+    m_ptr->deflateChunkSize = chunkSize;
+}
 void GzipHelper::setAttentionFileExtensions(const std::vector<String>& exts){
     m_ptr->extFilters = exts;
 }
@@ -736,6 +1289,12 @@ bool GzipHelper::decompressFile(CString file, CString outDir){
 bool GzipHelper::decompressFileToMemory(CString file, std::map<String,String>& out){
     return m_ptr->decompressFileToMemory(file, out);
 }
+bool GzipHelper::extractEntry(CString file, CString shortName, String& out){
+    return m_ptr->extractEntry(file, shortName, out);
+}
+bool GzipHelper::listEntries(CString file, std::vector<ZipEntryInfo>& out){
+    return m_ptr->listEntries(file, out);
+}
 bool GzipHelper::compressMemoryFiles(const std::vector<ZipFileItem>& items,
                                      CString outFile){
     return m_ptr->compressMemoryFiles(items, outFile);
@@ -30,6 +30,26 @@ struct GroupItem
     GroupItem filter(CString ext, bool remove);
 };
 
+//entry of an archive, read from the index only.
+struct ZipEntryInfo
+{
+    String shortName;
+    String groupName;
+    int group {0};          //group index in file order
+    long long size {-1};    //content length, -1 if unknown (v1 archive)
+};
+
+//the threads a compressor may use for one group. they are shared with the
+//other groups of the archive.
+struct CompressBudget
+{
+    int threads {1};    //threads which may work on the group, the caller included
+    //run a task on a shared thread, set if 'threads' > 1. it may start only
+    //after the other groups leave a thread free, so never wait on a task
+    //that has not started.
+    std::function<void(std::function<void()>)> spawn;
+};
+
 typedef struct GzipHelper_Ctx0 GzipHelper_Ctx0;
 
 class GzipHelper{
@@ -37,6 +57,9 @@ public:
     using FUNC_Classify = std::function<void(const std::vector<ZipFileItem>&, std::vector<GroupItem>&)>;
     //compressor to compress file content.
     using FUNC_Compressor = std::function<bool(const std::vector<ZipFileItem>&, String*)>;
+    //compressor which may split a group on the threads of 'CompressBudget'.
+    using FUNC_ParallelCompressor = std::function<bool(const std::vector<ZipFileItem>&, String*,
+                                                       const CompressBudget&)>;
     using FUNC_DeCompressor = std::function<bool(String&,std::vector<String>&)>;
 
     GzipHelper();
@@ -46,8 +69,13 @@ public:
     void setUseSimpleEncDec();
     void setClassifier(FUNC_Classify func);
     void setCompressor(FUNC_Compressor func);
+    void setCompressor(FUNC_ParallelCompressor func);
     void setDeCompressor(FUNC_DeCompressor func);
     void setConcurrentThreadCount(int count);
+    //split a group larger than 'chunkSize' and deflate the chunks on the
+    //concurrent threads the other groups leave free. 0 to disable(default).
+    //only for default compressor.
+    void setParallelDeflateChunkSize(size_t chunkSize);
     void setAttentionFileExtensions(const std::vector<String>&);
     void setDebug(bool debug);
     void setExcludeDirs(const std::vector<String>&);
@@ -65,6 +93,11 @@ public:
     bool decompressFile(CString file, CString outDir);
     bool decompressFileToMemory(CString file, std::map<String,String>& out);
 
+    //extract one file. only its group is read and decompressed.
+    bool extractEntry(CString file, CString shortName, String& out);
+    //list entries without decompressing.
+    bool listEntries(CString file, std::vector<ZipEntryInfo>& out);
+
 private:
     GzipHelper_Ctx0* m_ptr;
 };
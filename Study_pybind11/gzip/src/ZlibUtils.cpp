@@ -1,6 +1,12 @@
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include "ZlibUtils.h"
 #include "zlib.h"
+#include "core/src/ThreadPool.h"
 
 #define CHECK_ERR(err, msg) { \
 if (err != Z_OK) { \
@@ -9,6 +15,7 @@ if (err != Z_OK) { \
 } \
 }
 #define CHUNK 16384
+#define DICT_SIZE 32768
 
 namespace h7_gz {
 
@@ -180,6 +187,158 @@ bool ZlibUtils::decompress(CString str, String& out){
     return decompress(&is, &os);
 }
 
+//raw deflate of one chunk. non-last chunks end with a sync flush, so they
+//are byte aligned and can be concatenated.
+static bool _deflateChunk(const char* data, size_t len, const char* dict,
+                          size_t dictLen, bool last, String& out){
+    z_stream c_stream;
+    c_stream.zalloc = nullptr;
+    c_stream.zfree = nullptr;
+    c_stream.opaque = (voidpf)0;
+    auto err = deflateInit2(&c_stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS,
+                            8, Z_DEFAULT_STRATEGY);
+    CHECK_ERR(err, "deflateInit2");
+    if(dictLen > 0){
+        err = deflateSetDictionary(&c_stream, (const Bytef*)dict, dictLen);
+        if(err != Z_OK){
+            deflateEnd(&c_stream);
+            CHECK_ERR(err, "deflateSetDictionary");
+        }
+    }
+    out.resize(deflateBound(&c_stream, len) + 16);
+    c_stream.next_in = (Bytef*)data;
+    c_stream.avail_in = (uInt)len;
+    size_t outLen = 0;
+    const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    do{
+        if(outLen == out.size()){
+            out.resize(out.size() * 2);
+        }
+        c_stream.next_out = (Bytef*)out.data() + outLen;
+        c_stream.avail_out = out.size() - outLen;
+        err = deflate(&c_stream, flush);
+        if(err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR){
+            fprintf(stderr, "deflate error: %d\n", err);
+            deflateEnd(&c_stream);
+            return false;
+        }
+        outLen = out.size() - c_stream.avail_out;
+    }while(c_stream.avail_out == 0 || (last && err != Z_STREAM_END));
+    out.resize(outLen);
+    deflateEnd(&c_stream);
+    return true;
+}
+
+bool ZlibUtils::compressParallel(CString str, String& out, int threads,
+                                 size_t chunkSize){
+    if(threads <= 1 || chunkSize == 0 || str.length() <= chunkSize){
+        return compress(str, out);
+    }
+    const int count = (str.length() + chunkSize - 1) / chunkSize;
+    const int helpers = std::min(threads, count) - 1;
+    h7::ThreadPool pool(helpers);
+    return compressParallel(str, out, chunkSize, helpers,
+                            [&pool](std::function<void()> task){
+        pool.enqueue(std::move(task));
+    });
+}
+
+namespace {
+struct ParallelDeflate0{
+    const String* str {nullptr};
+    size_t chunkSize {0};
+    int count {0};
+    std::vector<String> outs;
+    std::vector<uLong> checks;
+    std::atomic<int> next {0};
+    int done {0};
+    bool failed {false};
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    //claim and deflate chunks until none left. a task started after that
+    //touches nothing but 'next'.
+    void run(){
+        for(;;){
+            const int i = next.fetch_add(1);
+            if(i >= count){
+                return;
+            }
+            const size_t pos = (size_t)i * chunkSize;
+            const size_t len = std::min(chunkSize, str->length() - pos);
+            const size_t dictLen = std::min(pos, (size_t)DICT_SIZE);
+            checks[i] = adler32(adler32(0L, Z_NULL, 0),
+                                (const Bytef*)str->data() + pos, len);
+            bool ok = _deflateChunk(str->data() + pos, len, str->data() + pos - dictLen,
+                                    dictLen, i == count - 1, outs[i]);
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                if(!ok){
+                    failed = true;
+                }
+                if(++done == count){
+                    cv.notify_all();
+                }
+            }
+        }
+    }
+};
+}
+
+bool ZlibUtils::compressParallel(CString str, String& out, size_t chunkSize,
+                                 int helpers, const FUNC_Spawn& spawn){
+    if(helpers <= 0 || chunkSize == 0 || str.length() <= chunkSize){
+        return compress(str, out);
+    }
+    auto pd = std::make_shared<ParallelDeflate0>();
+    pd->str = &str;
+    pd->chunkSize = chunkSize;
+    pd->count = (str.length() + chunkSize - 1) / chunkSize;
+    pd->outs.resize(pd->count);
+    pd->checks.resize(pd->count);
+    helpers = std::min(helpers, pd->count - 1);
+    for(int i = 0 ; i < helpers ; ++i){
+        spawn([pd](){
+            pd->run();
+        });
+    }
+    pd->run();
+    {
+        std::unique_lock<std::mutex> lck(pd->mtx);
+        pd->cv.wait(lck, [&pd](){
+            return pd->done == pd->count;
+        });
+        if(pd->failed){
+            return false;
+        }
+    }
+    const int count = pd->count;
+    auto& outs = pd->outs;
+    auto& checks = pd->checks;
+    //zlib header of deflateInit(Z_BEST_SPEED), then adler32 in big endian.
+    size_t total = 6;
+    for(auto& o : outs){
+        total += o.length();
+    }
+    out.reserve(out.length() + total);
+    out.push_back((char)0x78);
+    out.push_back((char)0x01);
+    uLong check = checks[0];
+    for(int i = 0 ; i < count ; ++i){
+        out.append(outs[i]);
+        if(i > 0){
+            const size_t len = std::min(chunkSize, str.length() - (size_t)i * chunkSize);
+            check = adler32_combine(check, checks[i], len);
+        }
+    }
+    //free the chunks now, late helpers still hold 'pd'.
+    std::vector<String>().swap(outs);
+    for(int i = 3 ; i >= 0 ; --i){
+        out.push_back((char)((check >> (i * 8)) & 0xff));
+    }
+    return true;
+}
+
 // bool readGZ(CString file, CString outDir){
 //     std::unique_ptr<gzFile_s, GZDeleter> inPtr(gzopen(file.data(), "rb"));
 //     char buf[CHUNK];
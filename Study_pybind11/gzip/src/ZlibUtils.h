@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <functional>
 
 namespace h7_gz {
 
@@ -32,6 +33,19 @@ public:
     static bool compress(CString str, String& out);
 
     static bool decompress(CString str, String& out);
+
+    //run a task on another thread. it may start late, after the chunks are done.
+    using FUNC_Spawn = std::function<void(std::function<void()>)>;
+
+    //pigz style: deflate 'chunkSize' chunks on 'threads' threads, each primed
+    //with the previous 32K. output is still one zlib stream.
+    static bool compressParallel(CString str, String& out, int threads,
+                                 size_t chunkSize);
+    //like above, the caller and up to 'helpers' tasks given to 'spawn' claim
+    //the chunks in turn. only chunks already claimed are waited for, so 'spawn'
+    //may queue to a pool the caller itself runs on.
+    static bool compressParallel(CString str, String& out, size_t chunkSize,
+                                 int helpers, const FUNC_Spawn& spawn);
 };
 
 }